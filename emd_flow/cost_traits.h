@@ -0,0 +1,63 @@
+#ifndef __COST_TRAITS_H__
+#define __COST_TRAITS_H__
+
+#include <cmath>
+#include <limits>
+
+// The flow networks work either with double costs or with 64-bit integer
+// costs. In the integer mode, amplitudes and lambda are rounded to multiples
+// of max_amplitude / kIntegerAmplitudeRange, i.e., every amplitude and every
+// column arc cost changes by at most max_amplitude * 2^-31 (a relative error
+// of less than 5e-10 w.r.t. the largest amplitude). The flow is then optimal
+// for the rounded costs, so its cost for the original problem is within
+// 2 * (k * c + EMD) * max_amplitude * 2^-31 of the optimum.
+// All path costs stay below 2^62 as long as
+// lambda * num_rows * num_columns < 2^31 * max_amplitude.
+const double kIntegerAmplitudeRange = 1073741824.0;  // 2^30
+
+template <typename CostType>
+struct CostTraits;
+
+template <>
+struct CostTraits<double> {
+  static double infinity() {
+    return std::numeric_limits<double>::infinity();
+  }
+
+  static double quantization_scale(double /*max_amplitude*/) {
+    return 1.0;
+  }
+
+  static double quantize(double x, double /*scale*/) {
+    return x;
+  }
+
+  // reduced costs below -tolerance count as negative
+  static double tolerance(double max_abs_potential) {
+    return 1e-12 * (1.0 + max_abs_potential);
+  }
+};
+
+template <>
+struct CostTraits<long long> {
+  static long long infinity() {
+    return std::numeric_limits<long long>::max() / 4;
+  }
+
+  static double quantization_scale(double max_amplitude) {
+    if (max_amplitude <= 0.0) {
+      return 1.0;
+    }
+    return kIntegerAmplitudeRange / max_amplitude;
+  }
+
+  static long long quantize(double x, double scale) {
+    return std::llround(x * scale);
+  }
+
+  static long long tolerance(long long /*max_abs_potential*/) {
+    return 0;
+  }
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef __DISTANCE_TRANSFORM_H__
+#define __DISTANCE_TRANSFORM_H__
+
+#include <vector>
+#include <algorithm>
+
+// L1 distance transform of a column: out[j] = min_i in[i] + step * |i - j|
+// over all i with |i - j| <= max_shift, for j = 0, ..., n - 1. If argmin is
+// not NULL, argmin[j] is a minimizing i. Without a window (max_shift < 0 or
+// >= n - 1) this is the usual two-pass transform. Otherwise the minimum of
+// in[i] - step * i over i in [j - max_shift, j] (and of in[i] + step * i over
+// i in [j, j + max_shift]) is a sliding window minimum, computed with a queue
+// of the indices with increasing values. Large values (infinity) in in are
+// fine as long as adding step * n does not overflow Value.
+template <typename Value>
+void distance_transform(const Value* in, int n, Value step, int max_shift,
+    Value* out, int* argmin, std::vector<int>* queue) {
+  if (max_shift < 0 || max_shift >= n - 1) {
+    out[0] = in[0];
+    if (argmin != NULL) {
+      argmin[0] = 0;
+    }
+    for (int ii = 1; ii < n; ++ii) {
+      if (in[ii] <= out[ii - 1] + step) {
+        out[ii] = in[ii];
+        if (argmin != NULL) {
+          argmin[ii] = ii;
+        }
+      } else {
+        out[ii] = out[ii - 1] + step;
+        if (argmin != NULL) {
+          argmin[ii] = argmin[ii - 1];
+        }
+      }
+    }
+    for (int ii = n - 2; ii >= 0; --ii) {
+      if (out[ii + 1] + step < out[ii]) {
+        out[ii] = out[ii + 1] + step;
+        if (argmin != NULL) {
+          argmin[ii] = argmin[ii + 1];
+        }
+      }
+    }
+    return;
+  }
+
+  queue->resize(n);
+  int* q = &((*queue)[0]);
+  int head = 0;
+  int tail = 0;
+  for (int ii = 0; ii < n; ++ii) {
+    Value value = in[ii] - step * ii;
+    while (tail > head && in[q[tail - 1]] - step * q[tail - 1] >= value) {
+      --tail;
+    }
+    q[tail++] = ii;
+    if (q[head] < ii - max_shift) {
+      ++head;
+    }
+    out[ii] = in[q[head]] + step * (ii - q[head]);
+    if (argmin != NULL) {
+      argmin[ii] = q[head];
+    }
+  }
+  head = 0;
+  tail = 0;
+  for (int ii = n - 1; ii >= 0; --ii) {
+    Value value = in[ii] + step * ii;
+    while (tail > head && in[q[tail - 1]] + step * q[tail - 1] >= value) {
+      --tail;
+    }
+    q[tail++] = ii;
+    if (q[head] > ii + max_shift) {
+      ++head;
+    }
+    Value cur = in[q[head]] + step * (q[head] - ii);
+    if (cur < out[ii]) {
+      out[ii] = cur;
+      if (argmin != NULL) {
+        argmin[ii] = q[head];
+      }
+    }
+  }
+}
+
+#endif
@@ -4,14 +4,708 @@
 #include <ctime>
 #include <memory>
 #include <string>
+#include <map>
+#include <algorithm>
+#include <limits>
+#include <thread>
 
+#include "emd_flow.h"
 #include "emd_flow_network.h"
 #include "emd_flow_network_factory.h"
+#include "emd_flow_network_dp.h"
+#include "emd_flow_network_blocks.h"
+#include "emd_flow_candidates.h"
+#include "work_stealing_pool.h"
 
 using namespace std;
 
-void emd_flow(
-    const vector<vector<double> >& a,
+namespace {
+
+// Result of one run of a flow network in emd_flow.
+struct LambdaEvaluation {
+  double lambda;
+  int emd_cost;
+  double amp_sum;
+  vector<vector<bool> > support;
+  // thread CPU times, zero without EMD_FLOW_STATS
+  EMDFlowPhaseTime run_flow_time;
+  EMDFlowPhaseTime extraction_time;
+};
+
+void extract_evaluation(EMDFlowNetwork* network,
+    LambdaEvaluation* evaluation) {
+  evaluation->emd_cost = network->get_EMD_used();
+  evaluation->amp_sum = network->get_supported_amplitude_sum();
+  network->get_support(&(evaluation->support));
+}
+
+void run_evaluation(EMDFlowNetwork* network, LambdaEvaluation* evaluation) {
+  if (!EMD_FLOW_STATS) {
+    network->run_flow(evaluation->lambda);
+    extract_evaluation(network, evaluation);
+    return;
+  }
+  EMDFlowTimer run_flow_timer(true);
+  network->run_flow(evaluation->lambda);
+  evaluation->run_flow_time = run_flow_timer.elapsed();
+  EMDFlowTimer extraction_timer(true);
+  extract_evaluation(network, evaluation);
+  evaluation->extraction_time = extraction_timer.elapsed();
+}
+
+// Appends the runs to the trajectory of the statistics.
+void record_evaluations(const LambdaEvaluation* evaluations,
+    size_t num_evaluations, EMDFlowStats* stats) {
+  if (!EMD_FLOW_STATS) {
+    return;
+  }
+  for (size_t ii = 0; ii < num_evaluations; ++ii) {
+    EMDFlowLambdaRun run;
+    run.lambda = evaluations[ii].lambda;
+    run.emd_cost = evaluations[ii].emd_cost;
+    run.amp_sum = evaluations[ii].amp_sum;
+    run.run_flow = evaluations[ii].run_flow_time;
+    run.extraction = evaluations[ii].extraction_time;
+    stats->trajectory.push_back(run);
+  }
+  stats->num_lambda_evaluations += num_evaluations;
+}
+
+// Runs evaluation ii on network ii. All evaluations but the first run in
+// their own thread.
+void run_evaluations(const vector<EMDFlowNetwork*>& networks,
+    vector<LambdaEvaluation>* evaluations) {
+  vector<thread> threads;
+  for (size_t ii = 1; ii < evaluations->size(); ++ii) {
+    threads.push_back(thread(run_evaluation, networks[ii],
+        &((*evaluations)[ii])));
+  }
+  if (!evaluations->empty()) {
+    run_evaluation(networks[0], &((*evaluations)[0]));
+  }
+  for (size_t ii = 0; ii < threads.size(); ++ii) {
+    threads[ii].join();
+  }
+}
+
+// The search of emd_flow on already built networks (all with the right
+// sparsity). The evaluations of a round run in parallel on networks[0], ...,
+// networks[p - 1]. If lambda_guess is positive, the search first brackets
+// the final lambda around lambda_guess (see bracket_lambda) instead of
+// doubling lambda_high and bisecting from 0. Appends the runs to the
+// trajectory of stats. Returns the number of flow runs.
+int search_lambda(
+    const vector<EMDFlowNetwork*>& networks,
+    int emd_bound_low,
+    int emd_bound_high,
+    double lambda_high,
+    double lambda_eps,
+    double lambda_guess,
+    vector<vector<bool> >* result,
+    int* emd_cost,
+    double* amp_sum,
+    double* final_lambda,
+    EMDFlowStats* stats,
+    void (*output_function)(const char*),
+    bool verbose) {
+  const int kOutputBufferSize = 1000;
+  char output_buffer[kOutputBufferSize];
+  int num_threads = networks.size();
+  int num_runs = 0;
+
+  vector<LambdaEvaluation> evaluations;
+  int cur_emd_cost = 0;
+  double lambda_low = 0;
+
+  if (lambda_guess > 0) {
+    // The final lambda of a similar problem is usually close, so the search
+    // steps away from lambda_guess with steps that double until the EMD
+    // crosses the budget. If the final lambda is close to the guess, the
+    // bisection then starts from an interval of width lambda_guess / 16
+    // instead of [0, lambda_high]. The runs near the previous lambda are
+    // also the cheapest with warm-started networks.
+    if (verbose) {
+      snprintf(output_buffer, kOutputBufferSize,
+          "Searching around l = %f ...\n", lambda_guess);
+      output_function(output_buffer);
+    }
+
+    const double kInitialStep = 1.0 / 16;
+    double step = lambda_guess * kInitialStep;
+    double cur_lambda = lambda_guess;
+    bool have_high = false;
+    bool have_low = false;
+    evaluations.resize(1);
+    while (!have_high || !have_low) {
+      evaluations[0].lambda = cur_lambda;
+      run_evaluations(networks, &evaluations);
+      record_evaluations(&(evaluations[0]), 1, stats);
+      ++num_runs;
+      const LambdaEvaluation& cur = evaluations[0];
+      cur_emd_cost = cur.emd_cost;
+
+      if (verbose) {
+        snprintf(output_buffer, kOutputBufferSize, "l: %f  EMD: %d  amp sum: "
+            "%f\n", cur.lambda, cur_emd_cost, cur.amp_sum);
+        output_function(output_buffer);
+      }
+
+      if (cur_emd_cost <= emd_bound_high) {
+        lambda_high = cur.lambda;
+        *emd_cost = cur_emd_cost;
+        *amp_sum = cur.amp_sum;
+        *result = cur.support;
+        have_high = true;
+        if (cur_emd_cost >= emd_bound_low) {
+          break;
+        }
+        cur_lambda = lambda_high - step;
+        if (cur_lambda <= lambda_low) {
+          have_low = true;
+        }
+      } else {
+        lambda_low = cur.lambda;
+        have_low = true;
+        cur_lambda = lambda_low + step;
+      }
+      step = step * 2;
+    }
+  } else {
+    // make lambda larger until we find a solution that fits into the EMD
+    // budget
+    if (verbose) {
+      snprintf(output_buffer, kOutputBufferSize,
+          "Finding large enough value of lambda ...\n");
+      output_function(output_buffer);
+    }
+
+    bool found = false;
+    while (!found) {
+      evaluations.resize(num_threads);
+      for (int ii = 0; ii < num_threads; ++ii) {
+        evaluations[ii].lambda = lambda_high;
+        lambda_high = lambda_high * 2;
+      }
+      run_evaluations(networks, &evaluations);
+      record_evaluations(&(evaluations[0]), evaluations.size(), stats);
+      num_runs += evaluations.size();
+
+      for (int ii = 0; ii < num_threads; ++ii) {
+        const LambdaEvaluation& cur = evaluations[ii];
+        cur_emd_cost = cur.emd_cost;
+
+        if (verbose) {
+          snprintf(output_buffer, kOutputBufferSize, "l: %f  EMD: %d  amp "
+              "sum: %f\n", cur.lambda, cur_emd_cost, cur.amp_sum);
+          output_function(output_buffer);
+        }
+
+        if (cur_emd_cost <= emd_bound_high) {
+          lambda_high = cur.lambda;
+          *emd_cost = cur_emd_cost;
+          *amp_sum = cur.amp_sum;
+          *result = cur.support;
+          found = true;
+          break;
+        }
+      }
+    }
+  }
+
+  // binary search on lambda
+  if (verbose) {
+    snprintf(output_buffer, kOutputBufferSize, "Binary search on lambda ...\n");
+    output_function(output_buffer);
+  }
+
+  // Nodes of the bisection tree in heap order: node 1 is the midpoint of the
+  // current interval, nodes 2 * ii and 2 * ii + 1 are the midpoints of the
+  // intervals left and right of node ii. A node is evaluated only if its
+  // interval is longer than lambda_eps.
+  int num_levels = 1;
+  while ((2 << num_levels) - 1 <= num_threads) {
+    ++num_levels;
+  }
+  int num_tree_nodes = (1 << num_levels) - 1;
+  vector<double> node_low(num_tree_nodes + 1);
+  vector<double> node_high(num_tree_nodes + 1);
+  vector<int> node_evaluation(num_tree_nodes + 1);
+
+  while(lambda_high - lambda_low > lambda_eps
+      && (cur_emd_cost < emd_bound_low || cur_emd_cost > emd_bound_high)) {
+    evaluations.clear();
+    node_low[1] = lambda_low;
+    node_high[1] = lambda_high;
+    for (int node = 1; node <= num_tree_nodes; ++node) {
+      node_evaluation[node] = -1;
+      if (node > 1) {
+        int parent = node / 2;
+        if (node_evaluation[parent] < 0) {
+          continue;
+        }
+        double parent_mid = evaluations[node_evaluation[parent]].lambda;
+        if (node % 2 == 0) {
+          node_low[node] = node_low[parent];
+          node_high[node] = parent_mid;
+        } else {
+          node_low[node] = parent_mid;
+          node_high[node] = node_high[parent];
+        }
+        if (node_high[node] - node_low[node] <= lambda_eps) {
+          continue;
+        }
+      }
+      node_evaluation[node] = evaluations.size();
+      evaluations.push_back(LambdaEvaluation());
+      evaluations.back().lambda = (node_high[node] + node_low[node]) / 2;
+    }
+    run_evaluations(networks, &evaluations);
+    record_evaluations(&(evaluations[0]), evaluations.size(), stats);
+    num_runs += evaluations.size();
+
+    // follow the path of the serial binary search through the tree
+    int node = 1;
+    while (node <= num_tree_nodes && node_evaluation[node] >= 0
+        && lambda_high - lambda_low > lambda_eps
+        && (cur_emd_cost < emd_bound_low || cur_emd_cost > emd_bound_high)) {
+      const LambdaEvaluation& cur = evaluations[node_evaluation[node]];
+      cur_emd_cost = cur.emd_cost;
+
+      if (verbose) {
+        snprintf(output_buffer, kOutputBufferSize, "l_cur: %f  (l_low: %f, "
+            "l_high: %f)  EMD: %d  amp sum: %f\n", cur.lambda, lambda_low,
+            lambda_high, cur_emd_cost, cur.amp_sum);
+        output_function(output_buffer);
+      }
+
+      if (cur_emd_cost <= emd_bound_high) {
+        lambda_high = cur.lambda;
+        *emd_cost = cur_emd_cost;
+        *amp_sum = cur.amp_sum;
+        *result = cur.support;
+        node = 2 * node;
+      } else {
+        lambda_low = cur.lambda;
+        node = 2 * node + 1;
+      }
+    }
+  }
+
+  // The result is the solution of the last run with lambda_high. Running the
+  // network again with lambda_high is not equivalent: a warm-started network
+  // can return a different optimal flow (with a different EMD) if there are
+  // ties.
+  *final_lambda = lambda_high;
+
+  if (verbose) {
+    snprintf(output_buffer, kOutputBufferSize, "Final l: %f, amp sum: %f, "
+        "EMD cost: %d\n", lambda_high, *amp_sum, *emd_cost);
+    output_function(output_buffer);
+  }
+
+  return num_runs;
+}
+
+// Best support with EMD 0, i.e., the same k rows in every column: the k rows
+// with the largest row sums (of the absolute values, like the networks).
+// For lambda larger than the sum of the k largest amplitudes per column
+// minus the amp sum of this support, every support with EMD at least 1 is
+// worse, so this support is optimal. The lambda of the returned evaluation
+// is this bound.
+void evaluate_emd_zero(const EMDFlowAmplitudes& a, int k,
+    LambdaEvaluation* evaluation) {
+  int r = a.num_rows();
+  int c = a.num_columns();
+  k = min(k, r);
+
+  vector<pair<double, int> > row_sums(r);
+  for (int row = 0; row < r; ++row) {
+    row_sums[row] = make_pair(0.0, row);
+    for (int col = 0; col < c; ++col) {
+      row_sums[row].first += abs(a(row, col));
+    }
+  }
+  partial_sort(row_sums.begin(), row_sums.begin() + k, row_sums.end(),
+      greater<pair<double, int> >());
+
+  evaluation->emd_cost = 0;
+  evaluation->amp_sum = 0.0;
+  evaluation->support.assign(r, vector<bool>(c, false));
+  for (int ii = 0; ii < k; ++ii) {
+    evaluation->amp_sum += row_sums[ii].first;
+    for (int col = 0; col < c; ++col) {
+      evaluation->support[row_sums[ii].second][col] = true;
+    }
+  }
+
+  double max_amp_sum = 0.0;
+  vector<double> column(r);
+  for (int col = 0; col < c; ++col) {
+    for (int row = 0; row < r; ++row) {
+      column[row] = abs(a(row, col));
+    }
+    nth_element(column.begin(), column.begin() + (r - k), column.end());
+    for (int row = r - k; row < r; ++row) {
+      max_amp_sum += column[row];
+    }
+  }
+  evaluation->lambda = max(max_amp_sum - evaluation->amp_sum, 0.0);
+}
+
+// Alternative to search_lambda that uses the EMD and amp sum of every run.
+// A solution with EMD e and amp sum A is optimal for lambda if it minimizes
+// lambda * e - A, so it gives a supporting line of the (concave) trade-off
+// curve. The bracket [lambda_low, lambda_high] starts with lambda = 0 and the
+// analytic bound of evaluate_emd_zero (no doubling), and the next lambda is
+// the intersection of the lines of the two ends of the bracket, i.e., a
+// secant step on the Lagrangian dual. If the solution for the intersection
+// is on both lines, the two ends are neighbouring vertices of the curve and
+// lambda_high is the final lambda. The secant steps converge slowly if the
+// curve is strongly curved near the budget, so a bisection step (on a log
+// scale) is taken after two steps that did not halve the EMD range of the
+// bracket. lambda_eps only limits these bisection steps: the secant steps
+// stop at a vertex of the curve (every step finds a new vertex or proves
+// that the two ends are neighbours), so the result does not depend on the
+// resolution of lambda. Like search_lambda, the search stops at the first
+// run with EMD in [emd_bound_low, emd_bound_high].
+// Uses only networks[0]. Appends the runs to the trajectory of stats. Returns
+// the number of flow runs.
+int search_lambda_secant(
+    EMDFlowNetwork* network,
+    const EMDFlowAmplitudes& a,
+    int k,
+    int emd_bound_low,
+    int emd_bound_high,
+    double lambda_eps,
+    vector<vector<bool> >* result,
+    int* emd_cost,
+    double* amp_sum,
+    double* final_lambda,
+    EMDFlowStats* stats,
+    void (*output_function)(const char*),
+    bool verbose) {
+  const int kOutputBufferSize = 1000;
+  char output_buffer[kOutputBufferSize];
+  int num_runs = 0;
+
+  LambdaEvaluation high;
+  evaluate_emd_zero(a, k, &high);
+  *emd_cost = high.emd_cost;
+  *amp_sum = high.amp_sum;
+  *result = high.support;
+
+  LambdaEvaluation low;
+  low.lambda = 0.0;
+  run_evaluation(network, &low);
+  record_evaluations(&low, 1, stats);
+  ++num_runs;
+
+  if (verbose) {
+    snprintf(output_buffer, kOutputBufferSize, "Secant search on lambda in "
+        "[0, %f] ...\n", high.lambda);
+    output_function(output_buffer);
+    snprintf(output_buffer, kOutputBufferSize, "l: %f  EMD: %d  amp sum: "
+        "%f\n", low.lambda, low.emd_cost, low.amp_sum);
+    output_function(output_buffer);
+  }
+
+  if (low.emd_cost <= emd_bound_high) {
+    high = low;
+    *emd_cost = low.emd_cost;
+    *amp_sum = low.amp_sum;
+    *result = low.support;
+  }
+
+  int num_slow_steps = 0;
+  LambdaEvaluation cur;
+  while (low.emd_cost > emd_bound_high) {
+    int emd_width = low.emd_cost - high.emd_cost;
+    double lambda_cut = (low.amp_sum - high.amp_sum) / emd_width;
+    bool bracket_small = high.lambda - low.lambda <= lambda_eps;
+    bool secant_step = lambda_cut > low.lambda && lambda_cut < high.lambda
+        && (num_slow_steps < 2 || bracket_small);
+    if (!secant_step && bracket_small) {
+      break;
+    }
+    if (secant_step) {
+      cur.lambda = lambda_cut;
+    } else if (low.lambda > 0) {
+      // the analytic bound can be orders of magnitude too large
+      cur.lambda = sqrt(low.lambda * high.lambda);
+    } else {
+      cur.lambda = high.lambda / 2;
+    }
+    run_evaluation(network, &cur);
+    record_evaluations(&cur, 1, stats);
+    ++num_runs;
+
+    if (verbose) {
+      snprintf(output_buffer, kOutputBufferSize, "l_cur: %f  (l_low: %f, "
+          "l_high: %f)  EMD: %d  amp sum: %f%s\n", cur.lambda, low.lambda,
+          high.lambda, cur.emd_cost, cur.amp_sum,
+          secant_step ? "" : "  (bisection)");
+      output_function(output_buffer);
+    }
+
+    // no solution below the line through low and high
+    double line_value = cur.lambda * high.emd_cost - high.amp_sum;
+    double cur_value = cur.lambda * cur.emd_cost - cur.amp_sum;
+    double tolerance = 1e-9 * (1.0 + abs(line_value) + low.amp_sum);
+    bool neighbours = secant_step && cur_value >= line_value - tolerance;
+
+    if (cur.emd_cost <= emd_bound_high) {
+      high = cur;
+      *emd_cost = cur.emd_cost;
+      *amp_sum = cur.amp_sum;
+      *result = cur.support;
+      if (cur.emd_cost >= emd_bound_low) {
+        break;
+      }
+    } else {
+      low = cur;
+    }
+    if (neighbours) {
+      break;
+    }
+
+    // progress is measured by the EMD range of the bracket
+    if (secant_step && low.emd_cost - high.emd_cost > emd_width / 2) {
+      ++num_slow_steps;
+    } else {
+      num_slow_steps = 0;
+    }
+  }
+
+  *final_lambda = high.lambda;
+
+  if (verbose) {
+    snprintf(output_buffer, kOutputBufferSize, "Final l: %f, amp sum: %f, "
+        "EMD cost: %d\n", *final_lambda, *amp_sum, *emd_cost);
+    output_function(output_buffer);
+  }
+
+  return num_runs;
+}
+
+// Coarse amplitudes for coarse-to-fine solving: coarse row ii is the
+// maximum of the fine rows ii * factor, ..., (ii + 1) * factor - 1 (the last
+// group can be smaller). A fine path that stays within a group has about
+// the same amplitude sum as the coarse path through the group.
+void downsample_rows(const EMDFlowAmplitudes& a, int factor,
+    vector<vector<double> >* coarse) {
+  int r = a.num_rows();
+  int c = a.num_columns();
+  int coarse_r = (r + factor - 1) / factor;
+  coarse->assign(coarse_r, vector<double>(c, 0.0));
+  for (int row = 0; row < r; ++row) {
+    vector<double>& coarse_row = (*coarse)[row / factor];
+    for (int col = 0; col < c; ++col) {
+      coarse_row[col] = max(coarse_row[col], abs(a(row, col)));
+    }
+  }
+}
+
+}  // namespace
+
+EMDFlowSolver::EMDFlowSolver(
+    EMDFlowNetworkFactory::EMDFlowNetworkType alg_type, bool integer_costs,
+    int num_threads)
+    : num_network_builds(0), num_network_reuses(0), num_flow_runs(0),
+    num_coarse_flow_runs(0), alg_type_(alg_type), integer_costs_(integer_costs),
+    num_threads_(max(num_threads, 1)), network_type_(alg_type), max_shift_(0),
+    warm_start_(false), secant_search_(false), dynamic_program_(true),
+    num_candidates_(0), verify_candidates_(true), coarse_factor_(0),
+    num_column_blocks_(0), last_lambda_(0.0) { }
+
+EMDFlowSolver::~EMDFlowSolver() {
+  clear_networks();
+}
+
+void EMDFlowSolver::set_warm_start(bool warm_start) {
+  warm_start_ = warm_start;
+}
+
+void EMDFlowSolver::set_secant_search(bool secant_search) {
+  secant_search_ = secant_search;
+}
+
+void EMDFlowSolver::set_dynamic_program(bool dynamic_program) {
+  dynamic_program_ = dynamic_program;
+}
+
+void EMDFlowSolver::set_candidate_pruning(int num_candidates, bool verify) {
+  num_candidates_ = num_candidates;
+  verify_candidates_ = verify;
+  // the current networks were built for the old candidates
+  clear_networks();
+}
+
+void EMDFlowSolver::set_coarse_to_fine(int factor) {
+  coarse_factor_ = factor;
+}
+
+void EMDFlowSolver::set_column_blocks(int num_blocks) {
+  num_column_blocks_ = num_blocks;
+  clear_networks();
+}
+
+void EMDFlowSolver::clear_networks() {
+  for (size_t ii = 0; ii < networks_.size(); ++ii) {
+    delete networks_[ii];
+  }
+  networks_.clear();
+}
+
+// The networks only contain the column arcs for shifts up to emd_bound_high,
+// so they can be reused only if the amplitudes have the same size,
+// emd_bound_high is the same and k selects the same type of network.
+// Networks with heuristic candidates are never reused (the candidates
+// depend on the amplitudes), verified candidates remain valid.
+bool EMDFlowSolver::prepare_networks(const EMDFlowAmplitudes& a, int k,
+    int emd_bound_high, const EMDFlowCandidates* corridor) {
+  EMDFlowNetworkFactory::EMDFlowNetworkType type = alg_type_;
+  if (dynamic_program_
+      && EMDFlowNetworkDP::use_dynamic_program(a.num_rows(),
+          a.num_columns(), k)) {
+    type = EMDFlowNetworkFactory::kDynamicProgram;
+  }
+
+  if (corridor == NULL && !networks_.empty() && max_shift_ == emd_bound_high
+      && network_type_ == type
+      && networks_[0]->update_amplitudes(a, warm_start_)) {
+    for (size_t ii = 1; ii < networks_.size(); ++ii) {
+      networks_[ii]->update_amplitudes(a, warm_start_);
+    }
+    ++num_network_reuses;
+    return true;
+  }
+
+  clear_networks();
+  max_shift_ = emd_bound_high;
+  network_type_ = type;
+  ++num_network_builds;
+  // one network for all threads, they solve the blocks
+  if (num_column_blocks_ > 1 && corridor == NULL && a.num_columns() >= 3
+      && type != EMDFlowNetworkFactory::kDynamicProgram) {
+    networks_.push_back(new EMDFlowNetworkBlocks(a, type, emd_bound_high,
+        integer_costs_, num_column_blocks_, num_threads_));
+    return false;
+  }
+
+  EMDFlowCandidates candidates;
+  if (corridor != NULL) {
+    candidates = *corridor;
+  } else if (num_candidates_ > 0
+      && type != EMDFlowNetworkFactory::kDynamicProgram) {
+    select_EMD_flow_candidates(a, k, num_candidates_, emd_bound_high,
+        verify_candidates_, &candidates);
+  }
+  networks_.push_back(EMDFlowNetworkFactory::create_EMD_flow_network(a,
+      type, emd_bound_high, integer_costs_, candidates).release());
+
+  // one network per thread, the copies share the graph with the first
+  // network if possible
+  for (int ii = 1; ii < num_threads_; ++ii) {
+    EMDFlowNetwork* copy = networks_[0]->clone();
+    if (copy == NULL) {
+      copy = EMDFlowNetworkFactory::create_EMD_flow_network(a, type,
+          emd_bound_high, integer_costs_, candidates).release();
+    }
+    networks_.push_back(copy);
+  }
+  return false;
+}
+
+bool EMDFlowSolver::use_coarse_to_fine(int num_rows, int num_columns, int k) {
+  if (coarse_factor_ <= 1) {
+    return false;
+  }
+  int coarse_rows = (num_rows + coarse_factor_ - 1) / coarse_factor_;
+  if (coarse_rows < kMinCoarseRows || coarse_rows < k) {
+    return false;
+  }
+  return !(dynamic_program_
+      && EMDFlowNetworkDP::use_dynamic_program(num_rows, num_columns, k));
+}
+
+// A coarse shift by one row corresponds to a fine shift by about factor
+// rows, so the coarse problem gets the EMD bounds divided by factor, and its
+// final lambda divided by factor is about the final lambda of the fine
+// problem. The coarse paths can leave the corridor in the fine problem
+// where the fine rows within a group differ, which the verification of the
+// corridor takes care of.
+void EMDFlowSolver::solve_coarse(const EMDFlowAmplitudes& a, int k,
+    int emd_bound_low, int emd_bound_high, double lambda_high,
+    double lambda_eps, EMDFlowCandidates* corridor, double* lambda_guess,
+    void (*output_function)(const char*), bool verbose) {
+  int factor = coarse_factor_;
+  int r = a.num_rows();
+  int c = a.num_columns();
+
+  vector<vector<double> > coarse_a;
+  downsample_rows(a, factor, &coarse_a);
+  EMDFlowSolver coarse_solver(alg_type_, integer_costs_, num_threads_);
+  coarse_solver.set_secant_search(secant_search_);
+  coarse_solver.set_dynamic_program(dynamic_program_);
+  coarse_solver.set_coarse_to_fine(factor);
+  coarse_solver.set_column_blocks(num_column_blocks_);
+  vector<vector<bool> > coarse_support;
+  int coarse_emd_cost = 0;
+  double coarse_amp_sum = 0.0;
+  double coarse_lambda = 0.0;
+  coarse_solver.solve(coarse_a, k, emd_bound_low / factor,
+      emd_bound_high / factor, lambda_high, lambda_eps, &coarse_support,
+      &coarse_emd_cost, &coarse_amp_sum, &coarse_lambda, output_function,
+      false);
+  num_coarse_flow_runs += coarse_solver.num_flow_runs
+      + coarse_solver.num_coarse_flow_runs;
+  *lambda_guess = coarse_lambda / factor;
+
+  // the k rows with the largest sums keep the corridor feasible
+  select_EMD_flow_candidates(a, k, 0, emd_bound_high, true, corridor);
+  vector<vector<bool> >& mask = corridor->mask;
+  for (size_t coarse_row = 0; coarse_row < coarse_support.size();
+      ++coarse_row) {
+    int first = max(0, static_cast<int>(coarse_row) * factor - factor);
+    int last = min(r - 1, static_cast<int>(coarse_row) * factor
+        + 2 * factor - 1);
+    for (int col = 0; col < c; ++col) {
+      if (coarse_support[coarse_row][col]) {
+        for (int row = first; row <= last; ++row) {
+          mask[row][col] = true;
+        }
+      }
+    }
+  }
+  close_EMD_flow_candidates(emd_bound_high, &mask);
+
+  if (verbose) {
+    const int kOutputBufferSize = 1000;
+    char output_buffer[kOutputBufferSize];
+    long long corridor_size = 0;
+    for (int row = 0; row < r; ++row) {
+      corridor_size += count(mask[row].begin(), mask[row].end(), true);
+    }
+    snprintf(output_buffer, kOutputBufferSize, "Coarse problem with %d rows: "
+        "EMD: %d  amp sum: %f  l: %f  (%lld flow runs)\nCorridor with %lld "
+        "entries\n", static_cast<int>(coarse_a.size()), coarse_emd_cost,
+        coarse_amp_sum, coarse_lambda, coarse_solver.num_flow_runs,
+        corridor_size);
+    output_function(output_buffer);
+  }
+}
+
+// With num_threads = p > 1, every round of the search evaluates up to p
+// values of lambda at once, each on its own copy of the network:
+// - the doubling phase tries lambda_high * 2^j for j = 0, ..., p - 1,
+// - the binary search evaluates the first floor(log2(p + 1)) levels of the
+//   bisection tree below the current interval.
+// The results are then consumed in the order of the serial search, so the
+// sequence of lambdas (and hence the result) is the same as for p = 1. The
+// only exception are ties: a network that was warm-started from a different
+// lambda can return a different optimal flow with the same cost.
+void EMDFlowSolver::solve(
+    const EMDFlowAmplitudes& a,
     int k,
     int emd_bound_low,
     int emd_bound_high,
@@ -21,17 +715,17 @@ void emd_flow(
     int* emd_cost,
     double* amp_sum,
     double* final_lambda,
-    EMDFlowNetworkFactory::EMDFlowNetworkType alg_type,
     void (*output_function)(const char*),
     bool verbose) {
 
-  clock_t total_time_begin = clock();
+  EMDFlowTimer total_timer(false);
+  stats = EMDFlowStats();
 
   const int kOutputBufferSize = 1000;
   char output_buffer[kOutputBufferSize];
 
-  int r = a.size();
-  int c = a[0].size();
+  int r = a.num_rows();
+  int c = a.num_columns();
 
   if (verbose) {
     snprintf(output_buffer, kOutputBufferSize, "r = %d,  c = %d,  k = %d,  "
@@ -41,107 +735,591 @@ void emd_flow(
     snprintf(output_buffer, kOutputBufferSize, "lambda_high = %f, "
         "lambda_eps = %f\n", lambda_high, lambda_eps);
     output_function(output_buffer);
+    if (integer_costs_) {
+      snprintf(output_buffer, kOutputBufferSize, "Using integer costs\n");
+      output_function(output_buffer);
+    }
+    if (num_threads_ > 1) {
+      snprintf(output_buffer, kOutputBufferSize, "Using %d threads\n",
+          num_threads_);
+      output_function(output_buffer);
+    }
   }
 
   // build graph
-  clock_t graph_construction_time_begin = clock();
+  EMDFlowTimer construction_timer(false);
 
-  auto_ptr<EMDFlowNetwork> network =
-      EMDFlowNetworkFactory::create_EMD_flow_network(a, alg_type);
-  network->set_sparsity(k);
+  // corridor and start of the lambda search from the coarse problem
+  bool coarse_to_fine = use_coarse_to_fine(r, c, k);
+  EMDFlowCandidates corridor;
+  double coarse_lambda_guess = 0.0;
+  if (coarse_to_fine) {
+    solve_coarse(a, k, emd_bound_low, emd_bound_high, lambda_high, lambda_eps,
+        &corridor, &coarse_lambda_guess, output_function, verbose);
+  }
+
+  bool reused = prepare_networks(a, k, emd_bound_high,
+      coarse_to_fine ? &corridor : NULL);
+  for (size_t ii = 0; ii < networks_.size(); ++ii) {
+    networks_[ii]->set_sparsity(k);
+  }
+  EMDFlowNetwork* network = networks_[0];
 
-  clock_t graph_construction_time = clock() - graph_construction_time_begin;
+  stats.construction = construction_timer.elapsed();
+  stats.reused_networks = reused;
+
+  // the counters of reused networks include the earlier calls
+  vector<EMDFlowNetworkStats> network_stats_before(networks_.size());
+  if (EMD_FLOW_STATS) {
+    for (size_t ii = 0; ii < networks_.size(); ++ii) {
+      networks_[ii]->get_statistics(&(network_stats_before[ii]));
+    }
+  }
+  EMDFlowTimer search_timer(false);
 
   if (verbose) {
     snprintf(output_buffer, kOutputBufferSize, "The graph has %d nodes and %d "
-        "edges.\n", network->get_num_nodes(), network->get_num_edges());
+        "edges%s.\n", network->get_num_nodes(), network->get_num_edges(),
+        reused ? " (reused)" : "");
     output_function(output_buffer);
     snprintf(output_buffer, kOutputBufferSize, "Total construction time: %f "
-        "s\n ", static_cast<double>(graph_construction_time) / CLOCKS_PER_SEC);
+        "s (CPU time %f s)\n", stats.construction.wall_time,
+        stats.construction.cpu_time);
     output_function(output_buffer);
+  }
+
+  if (secant_search_) {
+    num_flow_runs += search_lambda_secant(network, a, k, emd_bound_low,
+        emd_bound_high, lambda_eps, result, emd_cost, amp_sum, final_lambda,
+        &stats, output_function, verbose);
+  } else {
+    double lambda_guess = (warm_start_ && reused) ? last_lambda_ : 0.0;
+    if (coarse_to_fine) {
+      lambda_guess = coarse_lambda_guess;
+    }
+    num_flow_runs += search_lambda(networks_, emd_bound_low, emd_bound_high,
+        lambda_high, lambda_eps, lambda_guess, result, emd_cost, amp_sum,
+        final_lambda, &stats, output_function, verbose);
+  }
+  last_lambda_ = *final_lambda;
 
+  stats.search = search_timer.elapsed();
+  if (EMD_FLOW_STATS) {
+    for (size_t ii = 0; ii < networks_.size(); ++ii) {
+      EMDFlowNetworkStats network_stats;
+      networks_[ii]->get_statistics(&network_stats);
+      stats.network.add_difference(network_stats, network_stats_before[ii]);
+    }
   }
 
-  // make lambda larger until we find a solution that fits into the EMD budget
+  stats.total = total_timer.elapsed();
   if (verbose) {
-    snprintf(output_buffer, kOutputBufferSize,
-        "Finding large enough value of lambda ...\n");
+    snprintf(output_buffer, kOutputBufferSize, "Search time %f s (CPU time "
+        "%f s)\nTotal time %f s (CPU time %f s)\n", stats.search.wall_time,
+        stats.search.cpu_time, stats.total.wall_time, stats.total.cpu_time);
+    output_function(output_buffer);
+
+    string performance_diagnostics;
+    network->get_performance_diagnostics(&performance_diagnostics);
+    snprintf(output_buffer, kOutputBufferSize, "Performance diagnostics:\n%s\n",
+        performance_diagnostics.c_str());
     output_function(output_buffer);
   }
 
-  int cur_emd_cost = 0;
-  while (true) {
-    network->run_flow(lambda_high);
-    cur_emd_cost = network->get_EMD_used();
-    double cur_amp_sum = network->get_supported_amplitude_sum();
+  return;
+}
 
-    if (verbose) {
-      snprintf(output_buffer, kOutputBufferSize, "l: %f  EMD: %d  amp sum: %f"
-          "\n", lambda_high, cur_emd_cost, cur_amp_sum);
-      output_function(output_buffer);
-    }
+// The networks are built without an EMD bound (max_shift -1), so they are
+// reused by the following calls of solve_lambda but not by solve.
+void EMDFlowSolver::solve_lambda(
+    const EMDFlowAmplitudes& a,
+    int k,
+    double lambda,
+    vector<vector<bool> >* result,
+    int* emd_cost,
+    double* amp_sum) {
+  prepare_networks(a, k, -1, NULL);
+  EMDFlowNetwork* network = networks_[0];
+  network->set_sparsity(k);
+  network->run_flow(lambda);
+  ++num_flow_runs;
+  network->get_support(result);
+  *emd_cost = network->get_EMD_used();
+  *amp_sum = network->get_supported_amplitude_sum();
+}
 
-    if (cur_emd_cost <= emd_bound_high) {
-      break;
-    } else {
-      lambda_high = lambda_high * 2;
+void emd_flow(
+    const vector<vector<double> >& a,
+    int k,
+    int emd_bound_low,
+    int emd_bound_high,
+    double lambda_high,
+    double lambda_eps,
+    vector<vector<bool> >* result,
+    int* emd_cost,
+    double* amp_sum,
+    double* final_lambda,
+    EMDFlowNetworkFactory::EMDFlowNetworkType alg_type,
+    bool integer_costs,
+    int num_threads,
+    void (*output_function)(const char*),
+    bool verbose) {
+  emd_flow(a, k, emd_bound_low, emd_bound_high, lambda_high, lambda_eps,
+      result, emd_cost, amp_sum, final_lambda, alg_type, integer_costs,
+      num_threads, output_function, verbose, NULL);
+}
+
+void emd_flow(
+    const vector<vector<double> >& a,
+    int k,
+    int emd_bound_low,
+    int emd_bound_high,
+    double lambda_high,
+    double lambda_eps,
+    vector<vector<bool> >* result,
+    int* emd_cost,
+    double* amp_sum,
+    double* final_lambda,
+    EMDFlowNetworkFactory::EMDFlowNetworkType alg_type,
+    bool integer_costs,
+    int num_threads,
+    void (*output_function)(const char*),
+    bool verbose,
+    EMDFlowStats* stats) {
+  EMDFlowSolver solver(alg_type, integer_costs, num_threads);
+  solver.solve(a, k, emd_bound_low, emd_bound_high, lambda_high, lambda_eps,
+      result, emd_cost, amp_sum, final_lambda, output_function, verbose);
+  if (stats != NULL) {
+    *stats = solver.stats;
+  }
+}
+
+namespace {
+
+// Evaluates all sparsities 1, ..., max_k for the given lambda. Networks
+// without run_flow_sweep are run once per sparsity.
+void evaluate_sweep(EMDFlowNetwork* network, double lambda, int max_k,
+    vector<EMDFlowSparsityStep>* steps) {
+  if (network->run_flow_sweep(lambda, max_k, steps)) {
+    return;
+  }
+
+  int r = network->get_num_rows();
+  int c = network->get_num_columns();
+  vector<vector<bool> > prev_support(r, vector<bool>(c, false));
+  vector<vector<bool> > cur_support;
+  steps->clear();
+  for (int k = 1; k <= min(max_k, r); ++k) {
+    network->set_sparsity(k);
+    network->run_flow(lambda);
+    network->get_support(&cur_support);
+
+    steps->push_back(EMDFlowSparsityStep());
+    EMDFlowSparsityStep& step = steps->back();
+    step.emd_cost = network->get_EMD_used();
+    step.amp_sum = network->get_supported_amplitude_sum();
+    for (int row = 0; row < r; ++row) {
+      for (int col = 0; col < c; ++col) {
+        if (cur_support[row][col] && !prev_support[row][col]) {
+          step.added_entries.push_back(make_pair(row, col));
+        } else if (!cur_support[row][col] && prev_support[row][col]) {
+          step.removed_entries.push_back(make_pair(row, col));
+        }
+      }
     }
+    prev_support.swap(cur_support);
   }
+}
+
+}  // namespace
+
+void emd_flow_sparsity_sweep(
+    const vector<vector<double> >& a,
+    int max_k,
+    int emd_bound_low,
+    int emd_bound_high,
+    double lambda_high,
+    double lambda_eps,
+    vector<EMDFlowSweepResult>* results,
+    EMDFlowNetworkFactory::EMDFlowNetworkType alg_type,
+    bool integer_costs,
+    void (*output_function)(const char*),
+    bool verbose) {
+
+  EMDFlowTimer total_timer(false);
+
+  const int kOutputBufferSize = 1000;
+  char output_buffer[kOutputBufferSize];
+
+  int r = a.size();
+  int c = a[0].size();
 
-  // binary search on lambda
   if (verbose) {
-    snprintf(output_buffer, kOutputBufferSize, "Binary search on lambda ...\n");
+    snprintf(output_buffer, kOutputBufferSize, "r = %d,  c = %d,  max_k = %d,"
+        "  emd_bound_low = %d, emd_bound_high = %d\n", r, c, max_k,
+        emd_bound_low, emd_bound_high);
     output_function(output_buffer);
   }
 
-  double lambda_low = 0;
-  while(lambda_high - lambda_low > lambda_eps
-      && (cur_emd_cost < emd_bound_low || cur_emd_cost > emd_bound_high)) {
-    double cur_lambda = (lambda_high + lambda_low) / 2;
-    network->run_flow(cur_lambda);
-    cur_emd_cost = network->get_EMD_used();
-    double cur_amp_sum = network->get_supported_amplitude_sum();
+  auto_ptr<EMDFlowNetwork> network =
+      EMDFlowNetworkFactory::create_EMD_flow_network(a, alg_type,
+          emd_bound_high, integer_costs);
+
+  // steps of all lambdas evaluated so far
+  map<double, vector<EMDFlowSparsityStep> > evaluated;
+  int num_lookups = 0;
+
+  results->resize(max_k);
+  for (int k = 1; k <= max_k; ++k) {
+    // same search as in emd_flow, but all evaluations go through the cache
+    double cur_lambda_high = lambda_high;
+    double lambda_low = 0;
+    double result_lambda = 0;
+    int cur_emd_cost = 0;
+    bool first = true;
+    while (first || (cur_lambda_high - lambda_low > lambda_eps
+        && (cur_emd_cost < emd_bound_low || cur_emd_cost > emd_bound_high))) {
+      double cur_lambda = first ? cur_lambda_high
+                                : (cur_lambda_high + lambda_low) / 2;
+
+      ++num_lookups;
+      if (evaluated.find(cur_lambda) == evaluated.end()) {
+        evaluate_sweep(network.get(), cur_lambda, max_k,
+            &(evaluated[cur_lambda]));
+      }
+      const vector<EMDFlowSparsityStep>& steps = evaluated[cur_lambda];
+      int index = min(k, static_cast<int>(steps.size())) - 1;
+      cur_emd_cost = (index >= 0) ? steps[index].emd_cost : 0;
+
+      if (first) {
+        // make lambda larger until the solution fits into the EMD budget
+        if (cur_emd_cost <= emd_bound_high) {
+          result_lambda = cur_lambda;
+          first = false;
+        } else {
+          cur_lambda_high = cur_lambda_high * 2;
+        }
+      } else if (cur_emd_cost <= emd_bound_high) {
+        cur_lambda_high = cur_lambda;
+        result_lambda = cur_lambda;
+      } else {
+        lambda_low = cur_lambda;
+      }
+    }
+
+    // replay the steps of the final lambda
+    EMDFlowSweepResult& result = (*results)[k - 1];
+    const vector<EMDFlowSparsityStep>& steps = evaluated[result_lambda];
+    int num_steps = min(k, static_cast<int>(steps.size()));
+    result.support.assign(r, vector<bool>(c, false));
+    result.emd_cost = 0;
+    result.amp_sum = 0.0;
+    for (int ii = 0; ii < num_steps; ++ii) {
+      for (size_t jj = 0; jj < steps[ii].removed_entries.size(); ++jj) {
+        const pair<int, int>& entry = steps[ii].removed_entries[jj];
+        result.support[entry.first][entry.second] = false;
+      }
+      for (size_t jj = 0; jj < steps[ii].added_entries.size(); ++jj) {
+        const pair<int, int>& entry = steps[ii].added_entries[jj];
+        result.support[entry.first][entry.second] = true;
+      }
+      result.emd_cost = steps[ii].emd_cost;
+      result.amp_sum = steps[ii].amp_sum;
+    }
+    result.final_lambda = result_lambda;
 
     if (verbose) {
-      snprintf(output_buffer, kOutputBufferSize, "l_cur: %f  (l_low: %f, "
-          "l_high: %f)  EMD: %d  amp sum: %f\n", cur_lambda, lambda_low,
-          lambda_high, cur_emd_cost, cur_amp_sum);
+      snprintf(output_buffer, kOutputBufferSize, "k = %d: l: %f  EMD: %d  "
+          "amp sum: %f\n", k, result_lambda, result.emd_cost, result.amp_sum);
       output_function(output_buffer);
     }
+  }
 
-    if (cur_emd_cost <= emd_bound_high) {
-      lambda_high = cur_lambda;
-    } else {
-      lambda_low = cur_lambda;
+  if (verbose) {
+    EMDFlowPhaseTime total_time = total_timer.elapsed();
+    snprintf(output_buffer, kOutputBufferSize, "Evaluated %lu values of lambda "
+        "for %d lookups\nTotal time %f s (CPU time %f s)\n", evaluated.size(),
+        num_lookups, total_time.wall_time, total_time.cpu_time);
+    output_function(output_buffer);
+  }
+}
+
+namespace {
+
+// Task of emd_flow_batch for run_work_stealing. Every worker owns a
+// single-threaded EMDFlowSolver, so its network is rebuilt only if the next
+// problem does not fit it.
+class BatchSolver {
+ public:
+  BatchSolver(const vector<EMDFlowProblem>& problems, double lambda_high,
+      double lambda_eps, vector<EMDFlowBatchResult>* results,
+      EMDFlowNetworkFactory::EMDFlowNetworkType alg_type, bool integer_costs,
+      int num_workers)
+      : problems_(problems), lambda_high_(lambda_high),
+      lambda_eps_(lambda_eps), results_(results) {
+    for (int ii = 0; ii < num_workers; ++ii) {
+      solvers_.push_back(new EMDFlowSolver(alg_type, integer_costs, 1));
     }
   }
 
-  // run with final lambda
-  network->run_flow(lambda_high);
-  *emd_cost = network->get_EMD_used();
-  *amp_sum = network->get_supported_amplitude_sum();
-  *final_lambda = lambda_high;
-  network->get_support(result);
+  ~BatchSolver() {
+    for (size_t ii = 0; ii < solvers_.size(); ++ii) {
+      delete solvers_[ii];
+    }
+  }
 
-  if (verbose) {
-    snprintf(output_buffer, kOutputBufferSize, "Final l: %f, amp sum: %f, "
-        "EMD cost: %d\n", lambda_high, *amp_sum, *emd_cost);
-    output_function(output_buffer);
+  void operator()(int worker, size_t index) {
+    const EMDFlowProblem& problem = problems_[index];
+    EMDFlowBatchResult& result = (*results_)[index];
+    EMDFlowSolver* solver = solvers_[worker];
+
+    long long num_reuses = solver->num_network_reuses;
+    long long num_runs = solver->num_flow_runs;
+    solver->solve(*problem.amplitudes, problem.k, problem.emd_bound_low,
+        problem.emd_bound_high, lambda_high_, lambda_eps_, &result.support,
+        &result.emd_cost, &result.amp_sum, &result.final_lambda, NULL, false);
+
+    result.worker = worker;
+    result.reused_network = (solver->num_network_reuses > num_reuses);
+    result.num_flow_runs = solver->num_flow_runs - num_runs;
+    result.running_time = solver->stats.total.wall_time;
+  }
+
+ private:
+  const vector<EMDFlowProblem>& problems_;
+  double lambda_high_;
+  double lambda_eps_;
+  vector<EMDFlowBatchResult>* results_;
+  vector<EMDFlowSolver*> solvers_;
+};
+
+}  // namespace
+
+void emd_flow_batch(
+    const vector<EMDFlowProblem>& problems,
+    double lambda_high,
+    double lambda_eps,
+    vector<EMDFlowBatchResult>* results,
+    EMDFlowNetworkFactory::EMDFlowNetworkType alg_type,
+    bool integer_costs,
+    int num_threads) {
+  num_threads = max(num_threads, 1);
+  results->clear();
+  results->resize(problems.size());
+
+  // Estimated cost of a problem: k shortest path searches on a graph with
+  // r * c * min(r, 2 * emd_bound_high + 1) column arcs.
+  vector<pair<double, size_t> > costs(problems.size());
+  for (size_t ii = 0; ii < problems.size(); ++ii) {
+    const EMDFlowProblem& problem = problems[ii];
+    double r = problem.amplitudes->size();
+    double c = (*problem.amplitudes)[0].size();
+    double num_shifts = min(r, 2.0 * problem.emd_bound_high + 1.0);
+    costs[ii] = make_pair(-r * c * num_shifts * max(problem.k, 1), ii);
   }
+  sort(costs.begin(), costs.end());
+  vector<size_t> tasks(problems.size());
+  for (size_t ii = 0; ii < costs.size(); ++ii) {
+    tasks[ii] = costs[ii].second;
+  }
+
+  BatchSolver solver(problems, lambda_high, lambda_eps, results, alg_type,
+      integer_costs, num_threads);
+  run_work_stealing(num_threads, tasks, &solver);
+}
+
+namespace {
+
+// Optimal solution for one lambda in emd_flow_frontier.
+struct FrontierSolution {
+  double lambda;
+  int emd_cost;
+  double amp_sum;
+  vector<vector<bool> > support;
+};
+
+void solve_frontier_lambda(EMDFlowNetwork* network, double lambda,
+    FrontierSolution* solution) {
+  network->run_flow(lambda);
+  solution->lambda = lambda;
+  solution->emd_cost = network->get_EMD_used();
+  solution->amp_sum = network->get_supported_amplitude_sum();
+  network->get_support(&(solution->support));
+}
+
+// Appends the vertices of the trade-off curve strictly between left and
+// right (left has the larger EMD) to vertices, in order of increasing
+// lambda. The lines lambda * EMD - amp_sum of left and right intersect at
+// lambda_cut. If the optimal solution for lambda_cut lies below both lines,
+// it is a new vertex and both sides are refined recursively. Otherwise left
+// and right are neighbours on the curve (Eisner and Severance).
+void refine_frontier(EMDFlowNetwork* network, const FrontierSolution& left,
+    const FrontierSolution& right, vector<FrontierSolution>* vertices,
+    int* num_runs) {
+  if (left.emd_cost <= right.emd_cost + 1) {
+    return;
+  }
+  double lambda_cut = (left.amp_sum - right.amp_sum)
+      / (left.emd_cost - right.emd_cost);
+  if (!(lambda_cut > left.lambda && lambda_cut < right.lambda)) {
+    return;
+  }
+
+  FrontierSolution middle;
+  solve_frontier_lambda(network, lambda_cut, &middle);
+  ++(*num_runs);
+
+  double line_value = lambda_cut * left.emd_cost - left.amp_sum;
+  double middle_value = lambda_cut * middle.emd_cost - middle.amp_sum;
+  double tolerance = 1e-9 * (1.0 + abs(line_value) + left.amp_sum);
+  if (middle_value < line_value - tolerance
+      && middle.emd_cost < left.emd_cost
+      && middle.emd_cost > right.emd_cost) {
+    refine_frontier(network, left, middle, vertices, num_runs);
+    vertices->push_back(middle);
+    refine_frontier(network, middle, right, vertices, num_runs);
+  }
+}
+
+void add_support_difference(const vector<vector<bool> >& prev,
+    const vector<vector<bool> >& cur, EMDFlowFrontierPoint* point) {
+  for (size_t row = 0; row < cur.size(); ++row) {
+    for (size_t col = 0; col < cur[row].size(); ++col) {
+      if (cur[row][col] && !prev[row][col]) {
+        point->added_entries.push_back(make_pair(row, col));
+      } else if (!cur[row][col] && prev[row][col]) {
+        point->removed_entries.push_back(make_pair(row, col));
+      }
+    }
+  }
+}
 
+}  // namespace
+
+void emd_flow_frontier(
+    const vector<vector<double> >& a,
+    int k,
+    vector<EMDFlowFrontierPoint>* frontier,
+    EMDFlowNetworkFactory::EMDFlowNetworkType alg_type,
+    bool integer_costs,
+    void (*output_function)(const char*),
+    bool verbose) {
+
+  EMDFlowTimer total_timer(false);
+
+  const int kOutputBufferSize = 1000;
+  char output_buffer[kOutputBufferSize];
+
+  int r = a.size();
+  int c = a[0].size();
 
-  clock_t total_time = clock() - total_time_begin;
   if (verbose) {
-    snprintf(output_buffer, kOutputBufferSize, "Total time %f s\n",
-        static_cast<double>(total_time) / CLOCKS_PER_SEC);
+    snprintf(output_buffer, kOutputBufferSize, "r = %d,  c = %d,  k = %d\n",
+        r, c, k);
     output_function(output_buffer);
+  }
 
-    string performance_diagnostics;
-    network->get_performance_diagnostics(&performance_diagnostics);
-    snprintf(output_buffer, kOutputBufferSize, "Performance diagnostics:\n%s\n",
-        performance_diagnostics.c_str());
+  // there is no EMD budget, so all column arcs are needed
+  auto_ptr<EMDFlowNetwork> network =
+      EMDFlowNetworkFactory::create_EMD_flow_network(a, alg_type, -1,
+          integer_costs);
+  network->set_sparsity(k);
+  int num_runs = 0;
+
+  // Left end: lambda = 0 maximizes the amplitude sum. Right end: the EMD is
+  // 0 for large lambda (the same rows in every column are always possible).
+  // A bound like k * c * max_amplitude would need only one run but can be
+  // too large for the integer costs, so lambda is doubled instead.
+  double max_amplitude = 0.0;
+  for (int row = 0; row < r; ++row) {
+    for (int col = 0; col < c; ++col) {
+      max_amplitude = max(max_amplitude, abs(a[row][col]));
+    }
+  }
+  FrontierSolution left;
+  FrontierSolution right;
+  solve_frontier_lambda(network.get(), 0.0, &left);
+  ++num_runs;
+  double lambda_high = max(max_amplitude, 1e-9);
+  while (true) {
+    solve_frontier_lambda(network.get(), lambda_high, &right);
+    ++num_runs;
+    if (right.emd_cost == 0) {
+      break;
+    }
+    lambda_high = lambda_high * 2;
+  }
+
+  vector<FrontierSolution> vertices(1, left);
+  refine_frontier(network.get(), left, right, &vertices, &num_runs);
+  if (right.emd_cost < left.emd_cost) {
+    vertices.push_back(right);
+  }
+
+  // At lambda = 0 there can be several solutions with the largest amplitude
+  // sum, and the one found need not have the smallest EMD. It then lies on
+  // the curve only as an endpoint of a horizontal segment.
+  if (vertices.size() > 1
+      && vertices[0].amp_sum <= vertices[1].amp_sum
+          + 1e-9 * (1.0 + vertices[1].amp_sum)) {
+    vertices.erase(vertices.begin());
+  }
+
+  frontier->clear();
+  frontier->resize(vertices.size());
+  vector<vector<bool> > prev_support(r, vector<bool>(c, false));
+  for (size_t ii = 0; ii < vertices.size(); ++ii) {
+    EMDFlowFrontierPoint& point = (*frontier)[ii];
+    point.emd_cost = vertices[ii].emd_cost;
+    point.amp_sum = vertices[ii].amp_sum;
+    if (ii == 0) {
+      point.lambda_low = 0.0;
+    } else {
+      point.lambda_low = (vertices[ii - 1].amp_sum - vertices[ii].amp_sum)
+          / (vertices[ii - 1].emd_cost - vertices[ii].emd_cost);
+      (*frontier)[ii - 1].lambda_high = point.lambda_low;
+    }
+    add_support_difference(prev_support, vertices[ii].support, &point);
+    prev_support.swap(vertices[ii].support);
+
+    if (verbose) {
+      snprintf(output_buffer, kOutputBufferSize, "l >= %f: EMD: %d  amp sum: "
+          "%f\n", point.lambda_low, point.emd_cost, point.amp_sum);
+      output_function(output_buffer);
+    }
+  }
+  frontier->back().lambda_high = numeric_limits<double>::infinity();
+
+  if (verbose) {
+    EMDFlowPhaseTime total_time = total_timer.elapsed();
+    snprintf(output_buffer, kOutputBufferSize, "%lu breakpoints, %d flow "
+        "runs\nTotal time %f s (CPU time %f s)\n", frontier->size() - 1,
+        num_runs, total_time.wall_time, total_time.cpu_time);
     output_function(output_buffer);
   }
+}
 
-  return;
+size_t emd_flow_frontier_lookup(
+    const vector<EMDFlowFrontierPoint>& frontier,
+    int emd_bound_high,
+    int num_rows,
+    int num_columns,
+    vector<vector<bool> >* support) {
+  support->assign(num_rows, vector<bool>(num_columns, false));
+  size_t index = 0;
+  while (true) {
+    const EMDFlowFrontierPoint& point = frontier[index];
+    for (size_t jj = 0; jj < point.removed_entries.size(); ++jj) {
+      (*support)[point.removed_entries[jj].first][
+          point.removed_entries[jj].second] = false;
+    }
+    for (size_t jj = 0; jj < point.added_entries.size(); ++jj) {
+      (*support)[point.added_entries[jj].first][
+          point.added_entries[jj].second] = true;
+    }
+    if (point.emd_cost <= emd_bound_high || index + 1 == frontier.size()) {
+      return index;
+    }
+    ++index;
+  }
 }
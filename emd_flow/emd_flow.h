@@ -2,9 +2,19 @@
 #define __EMD_FLOW_H__
 
 #include <vector>
+#include <utility>
+#include <cstddef>
 
+#include "emd_flow_amplitudes.h"
+#include "emd_flow_network.h"
 #include "emd_flow_network_factory.h"
+#include "emd_flow_stats.h"
 
+// Searches for the lambda for which the flow network returns a support with
+// EMD in [emd_bound_low, emd_bound_high]. With num_threads > 1, several
+// values of lambda are evaluated in parallel in each step of the search.
+// For k <= 2 an exact dynamic program is used instead of the network given
+// by alg_type (see EMDFlowSolver::set_dynamic_program).
 void emd_flow(
     const std::vector<std::vector<double> >& a,
     int k,
@@ -17,7 +27,289 @@ void emd_flow(
     double* amp_sum,
     double* final_lambda,
     EMDFlowNetworkFactory::EMDFlowNetworkType alg_type,
+    bool integer_costs,
+    int num_threads,
     void (*output_function)(const char*),
     bool verbose);
 
+// emd_flow that also stores the statistics of the call (see
+// emd_flow_stats.h and EMDFlowSolver::stats).
+void emd_flow(
+    const std::vector<std::vector<double> >& a,
+    int k,
+    int emd_bound_low,
+    int emd_bound_high,
+    double lambda_high,
+    double lambda_eps,
+    std::vector<std::vector<bool> >* result,
+    int* emd_cost,
+    double* amp_sum,
+    double* final_lambda,
+    EMDFlowNetworkFactory::EMDFlowNetworkType alg_type,
+    bool integer_costs,
+    int num_threads,
+    void (*output_function)(const char*),
+    bool verbose,
+    EMDFlowStats* stats);
+
+// emd_flow for repeated calls, e.g., in the iterations of a recovery
+// algorithm. The solver keeps its flow networks between calls and only
+// updates the amplitudes (see EMDFlowNetwork::update_amplitudes) if they
+// have the same size and emd_bound_high is the same as in the last call.
+// Otherwise the networks are built again.
+class EMDFlowSolver {
+ public:
+  EMDFlowSolver(EMDFlowNetworkFactory::EMDFlowNetworkType alg_type,
+      bool integer_costs, int num_threads);
+  ~EMDFlowSolver();
+
+  // Same parameters as emd_flow. The amplitudes are read through the view
+  // (see emd_flow_amplitudes.h) while the networks are built or updated.
+  void solve(
+      const EMDFlowAmplitudes& a,
+      int k,
+      int emd_bound_low,
+      int emd_bound_high,
+      double lambda_high,
+      double lambda_eps,
+      std::vector<std::vector<bool> >* result,
+      int* emd_cost,
+      double* amp_sum,
+      double* final_lambda,
+      void (*output_function)(const char*),
+      bool verbose);
+
+  // Runs the flow for the given lambda only (no search and no EMD bound).
+  // The networks are kept between calls like for solve.
+  void solve_lambda(
+      const EMDFlowAmplitudes& a,
+      int k,
+      double lambda,
+      std::vector<std::vector<bool> >* result,
+      int* emd_cost,
+      double* amp_sum);
+
+  // For slowly changing amplitudes (e.g., in iterative recovery): if the
+  // networks are reused, they keep their flow and potentials and only
+  // re-optimize them for the new amplitudes (only the SAP networks support
+  // this, see EMDFlowNetwork::update_amplitudes), and the lambda search
+  // starts around the final lambda of the previous call instead of doubling
+  // lambda_high. The final lambda can then differ from a cold search within
+  // the resolution lambda_eps. Off by default.
+  void set_warm_start(bool warm_start);
+
+  // Uses the EMD and amp sum of every run for secant steps on lambda instead
+  // of a bisection, and brackets lambda with an analytic bound instead of
+  // doubling lambda_high (which is then ignored, as is the lambda of the
+  // previous call). Usually needs far fewer runs, but the search is serial,
+  // so only one thread is used. For emd_bound_low = emd_bound_high, the
+  // result is the solution the bisection converges to for lambda_eps -> 0,
+  // so it can have a larger amp sum than the bisection with lambda_eps > 0.
+  // With an EMD interval, both searches stop at their first run with EMD
+  // in the interval. Since they try different values of lambda, this can be
+  // a different solution, and the secant search can then also return a
+  // smaller amp sum than the bisection. Off by default.
+  void set_secant_search(bool secant_search);
+
+  // For small k the solver uses the dynamic program of emd_flow_network_dp.h
+  // (with double costs) instead of the network given by alg_type, see
+  // EMDFlowNetworkDP::use_dynamic_program. On by default.
+  void set_dynamic_program(bool dynamic_program);
+
+  // Builds the SAP networks only on the num_candidates largest entries of
+  // every column and the k rows with the largest sums (see
+  // select_EMD_flow_candidates), which makes the graph much smaller if
+  // num_candidates is small compared to the number of rows. With verify,
+  // every flow run checks the flow against the pruned entries with the
+  // potentials of the flow and adds the entries it needs, so the results are
+  // the same as without pruning. This pays off for large networks (many rows
+  // and a large emd_bound_high) with few significant entries per column. For
+  // dense amplitudes many entries are added and the verification can be
+  // slower than the full network. Without verify, the pruned entries are
+  // ignored (heuristic, and the networks are not reused). 0 (the default)
+  // disables the pruning. The other network types ignore the candidates.
+  void set_candidate_pruning(int num_candidates, bool verify);
+
+  // Coarse-to-fine solving for many rows: the solver first solves the
+  // problem with the maximum of every factor consecutive rows as amplitudes
+  // and the EMD bounds divided by factor (coarse-to-fine again if that
+  // problem is still large enough). The networks are then built only on a
+  // corridor around the coarse support (its rows widened by factor rows on
+  // both sides, and the k rows with the largest sums). The corridor is
+  // verified like the candidates of set_candidate_pruning, so the flow runs
+  // add the entries outside the corridor they need and the result is the
+  // same as without the corridor. The lambda search starts around the final
+  // lambda of the coarse problem divided by factor (see set_warm_start). A
+  // coarse problem is only solved if it has at least kMinCoarseRows and k
+  // rows and the dynamic program is not used. factor <= 1 (the default)
+  // disables coarse-to-fine solving.
+  void set_coarse_to_fine(int factor);
+  static const int kMinCoarseRows = 64;
+
+  // Splits the columns into num_blocks blocks that are solved in parallel
+  // (on num_threads threads) and coordinated with prices on the shared
+  // columns, with a global repair network as fallback (see
+  // emd_flow_network_blocks.h). The result is the same as without blocks.
+  // Useful for very wide matrices, where the lambda search itself is serial
+  // (secant search) or has few runs per thread. Not used for the dynamic
+  // program and for the corridor networks of set_coarse_to_fine (the coarse
+  // problems use the blocks). num_blocks <= 1 (the default) disables the
+  // blocks.
+  void set_column_blocks(int num_blocks);
+
+  long long num_network_builds;
+  long long num_network_reuses;
+  long long num_flow_runs;
+  // flow runs of the coarse problems (not included in num_flow_runs)
+  long long num_coarse_flow_runs;
+  // statistics of the last call of solve (the coarse problems only count
+  // in the construction time)
+  EMDFlowStats stats;
+
+ private:
+  EMDFlowNetworkFactory::EMDFlowNetworkType alg_type_;
+  bool integer_costs_;
+  int num_threads_;
+  // type of the current networks, alg_type_ or kDynamicProgram
+  EMDFlowNetworkFactory::EMDFlowNetworkType network_type_;
+  // one network per thread
+  std::vector<EMDFlowNetwork*> networks_;
+  // emd_bound_high the networks were built for
+  int max_shift_;
+  bool warm_start_;
+  bool secant_search_;
+  bool dynamic_program_;
+  int num_candidates_;
+  bool verify_candidates_;
+  int coarse_factor_;
+  int num_column_blocks_;
+  // final lambda of the last call
+  double last_lambda_;
+
+  // Returns true if the networks were reused. If corridor is not NULL, the
+  // networks are always built on it.
+  bool prepare_networks(const EMDFlowAmplitudes& a, int k,
+      int emd_bound_high, const EMDFlowCandidates* corridor);
+  bool use_coarse_to_fine(int num_rows, int num_columns, int k);
+  // Solves the coarse problem of set_coarse_to_fine and stores the corridor
+  // and the start of the lambda search for the fine problem.
+  void solve_coarse(const EMDFlowAmplitudes& a, int k,
+      int emd_bound_low, int emd_bound_high, double lambda_high,
+      double lambda_eps, EMDFlowCandidates* corridor, double* lambda_guess,
+      void (*output_function)(const char*), bool verbose);
+  void clear_networks();
+
+  EMDFlowSolver(const EMDFlowSolver&);
+  EMDFlowSolver& operator=(const EMDFlowSolver&);
+};
+
+// Result of the budget search for one sparsity in emd_flow_sparsity_sweep.
+struct EMDFlowSweepResult {
+  std::vector<std::vector<bool> > support;
+  int emd_cost;
+  double amp_sum;
+  double final_lambda;
+};
+
+// Runs the search of emd_flow for every sparsity k = 1, ..., max_k and stores
+// the result for k in (*results)[k - 1]. Every distinct lambda is evaluated
+// once for all k (see EMDFlowNetwork::run_flow_sweep) and cached as support
+// changes, and each k runs its own search on the cached evaluations. The
+// saving over max_k calls of emd_flow therefore depends on how many lambdas
+// the searches of different k share; their bisections usually diverge, so
+// the sweep still runs several flow sweeps per k.
+void emd_flow_sparsity_sweep(
+    const std::vector<std::vector<double> >& a,
+    int max_k,
+    int emd_bound_low,
+    int emd_bound_high,
+    double lambda_high,
+    double lambda_eps,
+    std::vector<EMDFlowSweepResult>* results,
+    EMDFlowNetworkFactory::EMDFlowNetworkType alg_type,
+    bool integer_costs,
+    void (*output_function)(const char*),
+    bool verbose);
+
+// Vertex of the trade-off curve between EMD and amplitude sum computed by
+// emd_flow_frontier.
+struct EMDFlowFrontierPoint {
+  // the support is optimal for all lambda in [lambda_low, lambda_high]
+  double lambda_low;
+  double lambda_high;
+  int emd_cost;
+  double amp_sum;
+  // change of the support w.r.t. the previous point (for the first point
+  // w.r.t. the empty support). Entries are (row, column) pairs.
+  std::vector<std::pair<int, int> > added_entries;
+  std::vector<std::pair<int, int> > removed_entries;
+};
+
+// Computes all breakpoints of the optimal EMD as a function of lambda, i.e.,
+// the vertices of the concave trade-off curve between EMD and amplitude
+// sum, in order of increasing lambda (decreasing EMD). The breakpoints are
+// found directly by intersecting the lines of neighbouring solutions, which
+// takes about two flow runs per breakpoint (instead of a bisection with a
+// resolution of lambda_eps). A budget can then be answered without further
+// flow runs (see emd_flow_frontier_lookup). Solutions that are optimal only
+// exactly at a breakpoint (between the two vertices of a segment) are not
+// listed. For amplitudes in general position there are none.
+void emd_flow_frontier(
+    const std::vector<std::vector<double> >& a,
+    int k,
+    std::vector<EMDFlowFrontierPoint>* frontier,
+    EMDFlowNetworkFactory::EMDFlowNetworkType alg_type,
+    bool integer_costs,
+    void (*output_function)(const char*),
+    bool verbose);
+
+// Returns the index of the first point of the frontier with EMD at most
+// emd_bound_high (the last point if there is none) and stores its support.
+// Up to ties exactly at a breakpoint, this is the solution emd_flow
+// converges to for the budget.
+size_t emd_flow_frontier_lookup(
+    const std::vector<EMDFlowFrontierPoint>& frontier,
+    int emd_bound_high,
+    int num_rows,
+    int num_columns,
+    std::vector<std::vector<bool> >* support);
+
+// One problem of emd_flow_batch.
+struct EMDFlowProblem {
+  // not copied, has to stay valid until emd_flow_batch returns
+  const std::vector<std::vector<double> >* amplitudes;
+  int k;
+  int emd_bound_low;
+  int emd_bound_high;
+};
+
+struct EMDFlowBatchResult {
+  std::vector<std::vector<bool> > support;
+  int emd_cost;
+  double amp_sum;
+  double final_lambda;
+  // worker thread that solved the problem
+  int worker;
+  // true if the network of the previous problem of the worker was reused
+  bool reused_network;
+  int num_flow_runs;
+  // wall-clock time in seconds
+  double running_time;
+};
+
+// Solves independent problems with the search of emd_flow on num_threads
+// threads and stores the result for problems[ii] in (*results)[ii]. The
+// problems are scheduled largest first, idle threads steal work from busy
+// ones (see work_stealing_pool.h). Every thread keeps its network and
+// reuses it for the next problem with the same size and emd_bound_high (see
+// EMDFlowSolver).
+void emd_flow_batch(
+    const std::vector<EMDFlowProblem>& problems,
+    double lambda_high,
+    double lambda_eps,
+    std::vector<EMDFlowBatchResult>* results,
+    EMDFlowNetworkFactory::EMDFlowNetworkType alg_type,
+    bool integer_costs,
+    int num_threads);
+
 #endif
@@ -0,0 +1,54 @@
+#ifndef __EMD_FLOW_AMPLITUDES_H__
+#define __EMD_FLOW_AMPLITUDES_H__
+
+#include <cstddef>
+#include <vector>
+
+// Read-only view of an r x c amplitude matrix that EMDFlowSolver, the
+// network factory and the networks read the amplitudes from. The matrix is
+// either a vector of rows or a strided buffer, where entry (row, col) is
+// data[row * row_stride + col * column_stride] (strides in elements). With
+// the strided form, row-major and column-major buffers of other languages
+// (see emd_flow_c.h and mex_wrapper.cc) are read in place: the networks copy
+// the amplitudes into their own layout once, without an intermediate
+// matrix. The view does not own the matrix, which has to stay valid while
+// the view is used.
+class EMDFlowAmplitudes {
+ public:
+  // Not explicit, so a matrix can be passed wherever a view is expected.
+  EMDFlowAmplitudes(const std::vector<std::vector<double> >& a)
+      : rows_(&a), data_(NULL), num_rows_(a.size()),
+      num_columns_(a.empty() ? 0 : a[0].size()), row_stride_(0),
+      column_stride_(0) { }
+
+  EMDFlowAmplitudes(const double* data, int num_rows, int num_columns,
+      ptrdiff_t row_stride, ptrdiff_t column_stride)
+      : rows_(NULL), data_(data), num_rows_(num_rows),
+      num_columns_(num_columns), row_stride_(row_stride),
+      column_stride_(column_stride) { }
+
+  int num_rows() const {
+    return num_rows_;
+  }
+
+  int num_columns() const {
+    return num_columns_;
+  }
+
+  double operator()(int row, int col) const {
+    if (rows_ != NULL) {
+      return (*rows_)[row][col];
+    }
+    return data_[row * row_stride_ + col * column_stride_];
+  }
+
+ private:
+  const std::vector<std::vector<double> >* rows_;
+  const double* data_;
+  int num_rows_;
+  int num_columns_;
+  ptrdiff_t row_stride_;
+  ptrdiff_t column_stride_;
+};
+
+#endif
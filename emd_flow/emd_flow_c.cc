@@ -0,0 +1,158 @@
+#include "emd_flow_c.h"
+#include "emd_flow.h"
+#include "emd_flow_network_factory.h"
+
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct emd_flow_solver {
+  EMDFlowSolver solver;
+  vector<vector<bool> > support;
+
+  emd_flow_solver(EMDFlowNetworkFactory::EMDFlowNetworkType alg_type,
+      bool integer_costs, int num_threads)
+      : solver(alg_type, integer_costs, num_threads) { }
+};
+
+namespace {
+
+void no_output(const char*) { }
+
+}  // namespace
+
+int emd_flow_solver_create(const char* algorithm, int integer_costs,
+    int num_threads, emd_flow_solver** solver) {
+  if (solver == NULL) {
+    return EMD_FLOW_INVALID_ARGUMENT;
+  }
+  *solver = NULL;
+  EMDFlowNetworkFactory::EMDFlowNetworkType alg_type =
+      EMDFlowNetworkFactory::kShortestAugmentingPath;
+  if (algorithm != NULL) {
+    alg_type = EMDFlowNetworkFactory::parse_type(string(algorithm));
+    if (alg_type == EMDFlowNetworkFactory::kUnknownType) {
+      return EMD_FLOW_UNKNOWN_ALGORITHM;
+    }
+  }
+  try {
+    *solver = new emd_flow_solver(alg_type, integer_costs != 0, num_threads);
+  } catch (const bad_alloc&) {
+    return EMD_FLOW_OUT_OF_MEMORY;
+  } catch (...) {
+    return EMD_FLOW_INTERNAL_ERROR;
+  }
+  return EMD_FLOW_OK;
+}
+
+void emd_flow_solver_destroy(emd_flow_solver* solver) {
+  delete solver;
+}
+
+int emd_flow_solver_set_warm_start(emd_flow_solver* solver, int warm_start) {
+  if (solver == NULL) {
+    return EMD_FLOW_INVALID_ARGUMENT;
+  }
+  solver->solver.set_warm_start(warm_start != 0);
+  return EMD_FLOW_OK;
+}
+
+int emd_flow_solver_set_secant_search(emd_flow_solver* solver,
+    int secant_search) {
+  if (solver == NULL) {
+    return EMD_FLOW_INVALID_ARGUMENT;
+  }
+  solver->solver.set_secant_search(secant_search != 0);
+  return EMD_FLOW_OK;
+}
+
+int emd_flow_solver_set_dynamic_program(emd_flow_solver* solver,
+    int dynamic_program) {
+  if (solver == NULL) {
+    return EMD_FLOW_INVALID_ARGUMENT;
+  }
+  solver->solver.set_dynamic_program(dynamic_program != 0);
+  return EMD_FLOW_OK;
+}
+
+int emd_flow_solver_set_candidate_pruning(emd_flow_solver* solver,
+    int num_candidates, int verify) {
+  if (solver == NULL) {
+    return EMD_FLOW_INVALID_ARGUMENT;
+  }
+  solver->solver.set_candidate_pruning(num_candidates, verify != 0);
+  return EMD_FLOW_OK;
+}
+
+int emd_flow_solver_set_coarse_to_fine(emd_flow_solver* solver, int factor) {
+  if (solver == NULL) {
+    return EMD_FLOW_INVALID_ARGUMENT;
+  }
+  solver->solver.set_coarse_to_fine(factor);
+  return EMD_FLOW_OK;
+}
+
+int emd_flow_solver_set_column_blocks(emd_flow_solver* solver,
+    int num_blocks) {
+  if (solver == NULL) {
+    return EMD_FLOW_INVALID_ARGUMENT;
+  }
+  solver->solver.set_column_blocks(num_blocks);
+  return EMD_FLOW_OK;
+}
+
+// The networks read the amplitudes directly from the strided view (see
+// emd_flow_amplitudes.h) into their own layout, without an intermediate
+// matrix. The support matrix of the handle keeps its memory between calls
+// with the same size.
+int emd_flow_solver_solve(emd_flow_solver* solver,
+    const double* a, int rows, int columns,
+    ptrdiff_t row_stride, ptrdiff_t column_stride,
+    int k, int emd_bound_low, int emd_bound_high,
+    double lambda_high, double lambda_eps,
+    uint8_t* support, ptrdiff_t support_row_stride,
+    ptrdiff_t support_column_stride,
+    int* emd_cost, double* amp_sum, double* final_lambda) {
+  if (solver == NULL || a == NULL || support == NULL || rows < 1
+      || columns < 1 || k < 0 || k > rows || emd_bound_low < 0
+      || emd_bound_high < emd_bound_low || !(lambda_high > 0.0)
+      || !(lambda_eps > 0.0)) {
+    return EMD_FLOW_INVALID_ARGUMENT;
+  }
+
+  try {
+    EMDFlowAmplitudes amplitudes(a, rows, columns, row_stride,
+        column_stride);
+    int cur_emd_cost = 0;
+    double cur_amp_sum = 0.0;
+    double cur_final_lambda = 0.0;
+    solver->solver.solve(amplitudes, k, emd_bound_low, emd_bound_high,
+        lambda_high, lambda_eps, &(solver->support), &cur_emd_cost,
+        &cur_amp_sum, &cur_final_lambda, no_output, false);
+
+    for (int row = 0; row < rows; ++row) {
+      const vector<bool>& support_row = solver->support[row];
+      uint8_t* p = support + row * support_row_stride;
+      for (int col = 0; col < columns; ++col) {
+        p[col * support_column_stride] = support_row[col] ? 1 : 0;
+      }
+    }
+    if (emd_cost != NULL) {
+      *emd_cost = cur_emd_cost;
+    }
+    if (amp_sum != NULL) {
+      *amp_sum = cur_amp_sum;
+    }
+    if (final_lambda != NULL) {
+      *final_lambda = cur_final_lambda;
+    }
+  } catch (const bad_alloc&) {
+    return EMD_FLOW_OUT_OF_MEMORY;
+  } catch (...) {
+    // no exception may unwind through the C caller
+    return EMD_FLOW_INTERNAL_ERROR;
+  }
+  return EMD_FLOW_OK;
+}
@@ -0,0 +1,66 @@
+#ifndef __EMD_FLOW_C_H__
+#define __EMD_FLOW_C_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// C interface of EMDFlowSolver (see emd_flow.h), built as libemdflow.so.
+// The amplitude matrix is a strided view: entry (row, col) is
+// a[row * row_stride + col * column_stride] (strides in elements), so
+// row-major (row_stride = columns, column_stride = 1) and column-major
+// (row_stride = 1, column_stride = rows) buffers as well as sub-matrices
+// can be passed as they are. The networks read the view directly into
+// their own layout (see emd_flow_amplitudes.h), there is no intermediate
+// copy of the matrix. The support is written the same way into a
+// caller-provided buffer of one byte per entry (1 for entries in the
+// support, 0 otherwise).
+// The functions return EMD_FLOW_OK or a negative error code. A solver
+// handle must not be used by several threads at the same time.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EMD_FLOW_OK 0
+#define EMD_FLOW_INVALID_ARGUMENT -1
+#define EMD_FLOW_UNKNOWN_ALGORITHM -2
+#define EMD_FLOW_OUT_OF_MEMORY -3
+// any other failure inside the solver
+#define EMD_FLOW_INTERNAL_ERROR -4
+
+typedef struct emd_flow_solver emd_flow_solver;
+
+// algorithm is one of the names accepted by the --algorithm option of the
+// emd_flow binary (NULL for the default shortest augmenting path network).
+int emd_flow_solver_create(const char* algorithm, int integer_costs,
+    int num_threads, emd_flow_solver** solver);
+void emd_flow_solver_destroy(emd_flow_solver* solver);
+
+// see the corresponding EMDFlowSolver methods
+int emd_flow_solver_set_warm_start(emd_flow_solver* solver, int warm_start);
+int emd_flow_solver_set_secant_search(emd_flow_solver* solver,
+    int secant_search);
+int emd_flow_solver_set_dynamic_program(emd_flow_solver* solver,
+    int dynamic_program);
+int emd_flow_solver_set_candidate_pruning(emd_flow_solver* solver,
+    int num_candidates, int verify);
+int emd_flow_solver_set_coarse_to_fine(emd_flow_solver* solver, int factor);
+int emd_flow_solver_set_column_blocks(emd_flow_solver* solver,
+    int num_blocks);
+
+// Same parameters as EMDFlowSolver::solve. emd_cost, amp_sum and
+// final_lambda can be NULL.
+int emd_flow_solver_solve(emd_flow_solver* solver,
+    const double* a, int rows, int columns,
+    ptrdiff_t row_stride, ptrdiff_t column_stride,
+    int k, int emd_bound_low, int emd_bound_high,
+    double lambda_high, double lambda_eps,
+    uint8_t* support, ptrdiff_t support_row_stride,
+    ptrdiff_t support_column_stride,
+    int* emd_cost, double* amp_sum, double* final_lambda);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,83 @@
+#include "emd_flow_candidates.h"
+
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+using namespace std;
+
+void select_EMD_flow_candidates(
+    const EMDFlowAmplitudes& a,
+    int k,
+    int num_candidates,
+    int max_shift,
+    bool verify,
+    EMDFlowCandidates* candidates) {
+  int r = a.num_rows();
+  int c = a.num_columns();
+  candidates->verify = verify;
+  candidates->mask.assign(r, vector<bool>(c, false));
+  vector<vector<bool> >& mask = candidates->mask;
+
+  // the k rows with the largest sums
+  vector<pair<double, int> > rows(r);
+  for (int row = 0; row < r; ++row) {
+    double sum = 0.0;
+    for (int col = 0; col < c; ++col) {
+      sum += abs(a(row, col));
+    }
+    rows[row] = make_pair(sum, row);
+  }
+  int num_rows = min(k, r);
+  nth_element(rows.begin(), rows.begin() + num_rows, rows.end(),
+      greater<pair<double, int> >());
+  for (int ii = 0; ii < num_rows; ++ii) {
+    mask[rows[ii].second].assign(c, true);
+  }
+
+  // the num_candidates largest entries of every column
+  int num_kept = min(num_candidates, r);
+  if (num_kept > 0) {
+    vector<pair<double, int> > column(r);
+    for (int col = 0; col < c; ++col) {
+      for (int row = 0; row < r; ++row) {
+        column[row] = make_pair(abs(a(row, col)), row);
+      }
+      nth_element(column.begin(), column.begin() + num_kept - 1, column.end(),
+          greater<pair<double, int> >());
+      for (int ii = 0; ii < num_kept; ++ii) {
+        mask[column[ii].second][col] = true;
+      }
+    }
+  }
+
+  close_EMD_flow_candidates(max_shift, &mask);
+}
+
+void close_EMD_flow_candidates(int max_shift,
+    vector<vector<bool> >* mask) {
+  int r = mask->size();
+  int c = (*mask)[0].size();
+
+  // right to left, so that added predecessors get predecessors themselves
+  vector<int> num_kept_before(r + 1);
+  for (int col = c - 1; col > 0; --col) {
+    num_kept_before[0] = 0;
+    for (int row = 0; row < r; ++row) {
+      num_kept_before[row + 1] = num_kept_before[row]
+          + ((*mask)[row][col - 1] ? 1 : 0);
+    }
+    for (int row = 0; row < r; ++row) {
+      if (!(*mask)[row][col]) {
+        continue;
+      }
+      int first = (max_shift < 0 || row < max_shift) ? 0 : row - max_shift;
+      int last = (max_shift < 0 || row + max_shift >= r) ? r - 1
+          : row + max_shift;
+      if (num_kept_before[last + 1] == num_kept_before[first]) {
+        (*mask)[row][col - 1] = true;
+      }
+    }
+  }
+}
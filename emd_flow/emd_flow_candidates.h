@@ -0,0 +1,41 @@
+#ifndef __EMD_FLOW_CANDIDATES_H__
+#define __EMD_FLOW_CANDIDATES_H__
+
+#include <vector>
+
+#include "emd_flow_amplitudes.h"
+
+// Entries of the amplitude matrix a network is built on. The other entries
+// (and all arcs touching them) are left out of the graph.
+struct EMDFlowCandidates {
+  // mask[row][col] is true for the entries in the network
+  std::vector<std::vector<bool> > mask;
+  // If true, the network checks after every flow run whether the flow is
+  // still optimal for the full network and adds the entries that violate
+  // the optimality conditions otherwise (see EMDFlowNetworkSAP::run_flow),
+  // so the results are the same as without pruning. If false, the pruned
+  // entries are ignored (heuristic).
+  bool verify;
+};
+
+// Keeps the num_candidates largest entries (absolute values) of every
+// column and all entries of the k rows with the largest sums. The k rows
+// form the optimal support with EMD 0, so the kept entries always contain a
+// feasible solution. Every kept entry outside the first column then gets a
+// kept predecessor in the previous column (see close_EMD_flow_candidates).
+void select_EMD_flow_candidates(
+    const EMDFlowAmplitudes& a,
+    int k,
+    int num_candidates,
+    int max_shift,
+    bool verify,
+    EMDFlowCandidates* candidates);
+
+// Adds entries to the mask until every kept entry outside the first column
+// has a kept entry at most max_shift rows away (any row if max_shift is
+// negative) in the previous column, so that every kept entry can be reached
+// from the source. The missing predecessor is the entry in the same row.
+void close_EMD_flow_candidates(int max_shift,
+    std::vector<std::vector<bool> >* mask);
+
+#endif
@@ -0,0 +1,362 @@
+#include "emd_flow_io.h"
+
+#include <cmath>
+#include <cstring>
+#include <charconv>
+#include <new>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// Reads whitespace-separated numbers from a file in chunks.
+class TextReader {
+ public:
+  explicit TextReader(FILE* f)
+      : f_(f), buffer_(kChunkSize + kMaxTokenSize), begin_(0), end_(0),
+      eof_(false) { }
+
+  // Returns false at the end of the input or for a malformed number.
+  template <typename Value>
+  bool next(Value* value) {
+    const char* token = NULL;
+    size_t length = 0;
+    if (!next_token(&token, &length)) {
+      return false;
+    }
+    // from_chars does not accept a leading plus sign
+    if (length > 1 && token[0] == '+') {
+      ++token;
+      --length;
+    }
+    from_chars_result res = from_chars(token, token + length, *value);
+    return res.ec == errc() && res.ptr == token + length;
+  }
+
+ private:
+  static const size_t kChunkSize = 1 << 20;
+  // longer tokens are malformed
+  static const size_t kMaxTokenSize = 256;
+
+  FILE* f_;
+  vector<char> buffer_;
+  size_t begin_;
+  size_t end_;
+  bool eof_;
+
+  static bool is_space(char ch) {
+    return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r' || ch == '\v'
+        || ch == '\f';
+  }
+
+  // Moves the unread part to the front of the buffer and reads the next
+  // chunk behind it.
+  void refill() {
+    if (eof_) {
+      return;
+    }
+    memmove(&(buffer_[0]), &(buffer_[begin_]), end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+    size_t num_read = fread(&(buffer_[end_]), 1, buffer_.size() - end_, f_);
+    if (num_read == 0) {
+      eof_ = true;
+    }
+    end_ += num_read;
+  }
+
+  bool next_token(const char** token, size_t* length) {
+    for (;;) {
+      while (begin_ < end_ && is_space(buffer_[begin_])) {
+        ++begin_;
+      }
+      if (begin_ < end_) {
+        break;
+      }
+      if (eof_) {
+        return false;
+      }
+      refill();
+    }
+    // the whole token has to be in the buffer
+    if (end_ - begin_ < kMaxTokenSize) {
+      refill();
+    }
+    size_t token_end = begin_;
+    while (token_end < end_ && !is_space(buffer_[token_end])) {
+      ++token_end;
+    }
+    if (token_end - begin_ > kMaxTokenSize) {
+      return false;
+    }
+    *token = &(buffer_[begin_]);
+    *length = token_end - begin_;
+    begin_ = token_end;
+    return true;
+  }
+};
+
+int32_t read_int32(const char* p) {
+  int32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+void write_int32(FILE* f, int32_t value) {
+  fwrite(&value, sizeof(value), 1, f);
+}
+
+bool read_binary_header(const char* data, EMDFlowInput* problem,
+    int* value_size, string* error) {
+  if (memcmp(data, "EMDF", 4) != 0) {
+    *error = "not a binary EMD flow problem";
+    return false;
+  }
+  problem->r = read_int32(data + 4);
+  problem->c = read_int32(data + 8);
+  problem->k = read_int32(data + 12);
+  problem->emd_bound_low = read_int32(data + 16);
+  problem->emd_bound_high = read_int32(data + 20);
+  *value_size = read_int32(data + 24);
+  problem->algorithm = read_int32(data + 28);
+  if (problem->r <= 0 || problem->c <= 0
+      || (*value_size != 4 && *value_size != 8)) {
+    *error = "invalid header";
+    return false;
+  }
+  if (static_cast<long long>(problem->r) * problem->c > kMaxBinaryValues) {
+    *error = "too many amplitudes in the header";
+    return false;
+  }
+  return true;
+}
+
+// Reads the r * c values behind the header into problem->a.
+void read_binary_values(const char* values, int value_size,
+    EMDFlowInput* problem) {
+  problem->a.resize(problem->r);
+  for (int row = 0; row < problem->r; ++row) {
+    vector<double>& a_row = problem->a[row];
+    a_row.resize(problem->c);
+    const char* p = values
+        + static_cast<size_t>(row) * problem->c * value_size;
+    if (value_size == 8) {
+      memcpy(&(a_row[0]), p, problem->c * sizeof(double));
+    } else {
+      for (int col = 0; col < problem->c; ++col) {
+        float value;
+        memcpy(&value, p + col * sizeof(float), sizeof(float));
+        a_row[col] = value;
+      }
+    }
+    for (int col = 0; col < problem->c; ++col) {
+      a_row[col] = abs(a_row[col]);
+    }
+  }
+}
+
+void write_bits(FILE* f, const vector<vector<bool> >& support) {
+  int r = support.size();
+  int c = (r > 0) ? support[0].size() : 0;
+  vector<unsigned char> bits((static_cast<size_t>(r) * c + 7) / 8, 0);
+  size_t index = 0;
+  for (int row = 0; row < r; ++row) {
+    for (int col = 0; col < c; ++col) {
+      if (support[row][col]) {
+        bits[index / 8] |= 1 << (index % 8);
+      }
+      ++index;
+    }
+  }
+  if (!bits.empty()) {
+    fwrite(&(bits[0]), 1, bits.size(), f);
+  }
+}
+
+}  // namespace
+
+bool read_text_problem(FILE* f, bool emd_interval, EMDFlowInput* problem,
+    string* error) {
+  TextReader reader(f);
+  if (!reader.next(&(problem->r)) || !reader.next(&(problem->c))
+      || !reader.next(&(problem->k)) || !reader.next(&(problem->emd_bound_low))
+      || (emd_interval && !reader.next(&(problem->emd_bound_high)))) {
+    *error = "Cannot read the header (r c k emd_bound).";
+    return false;
+  }
+  if (!emd_interval) {
+    problem->emd_bound_high = problem->emd_bound_low;
+  }
+  problem->algorithm = 0;
+  if (problem->r <= 0 || problem->c <= 0) {
+    *error = "The matrix has to have at least one row and one column.";
+    return false;
+  }
+
+  problem->a.resize(problem->r);
+  for (int row = 0; row < problem->r; ++row) {
+    vector<double>& a_row = problem->a[row];
+    a_row.resize(problem->c);
+    for (int col = 0; col < problem->c; ++col) {
+      if (!reader.next(&(a_row[col]))) {
+        const size_t tmp_size = 200;
+        char tmp[tmp_size];
+        snprintf(tmp, tmp_size, "Cannot read amplitude (%d, %d).", row, col);
+        *error = tmp;
+        return false;
+      }
+      a_row[col] = abs(a_row[col]);
+    }
+  }
+  return true;
+}
+
+bool read_binary_problem(const string& file_name, EMDFlowInput* problem,
+    string* error) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *error = "Cannot open " + file_name + ".";
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0
+      || file_stat.st_size < static_cast<off_t>(kBinaryHeaderSize)) {
+    close(fd);
+    *error = file_name + " is too short for the header.";
+    return false;
+  }
+  size_t size = file_stat.st_size;
+  void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    *error = "Cannot map " + file_name + ".";
+    return false;
+  }
+  madvise(mapped, size, MADV_SEQUENTIAL);
+  const char* data = static_cast<const char*>(mapped);
+
+  int value_size = 0;
+  bool ok = read_binary_header(data, problem, &value_size, error);
+  if (!ok) {
+    *error = file_name + ": " + *error + ".";
+  } else if (size != kBinaryHeaderSize + static_cast<size_t>(problem->r)
+      * problem->c * value_size) {
+    *error = "The size of " + file_name + " does not match its header.";
+    ok = false;
+  } else {
+    read_binary_values(data + kBinaryHeaderSize, value_size, problem);
+  }
+  munmap(mapped, size);
+  return ok;
+}
+
+bool read_binary_frame(FILE* f, EMDFlowInput* problem, string* error) {
+  error->clear();
+  char header[kBinaryHeaderSize];
+  size_t num_read = fread(header, 1, kBinaryHeaderSize, f);
+  if (num_read == 0 && feof(f)) {
+    return false;
+  }
+  if (num_read != static_cast<size_t>(kBinaryHeaderSize)) {
+    *error = "truncated header";
+    return false;
+  }
+  int value_size = 0;
+  if (!read_binary_header(header, problem, &value_size, error)) {
+    return false;
+  }
+  size_t num_bytes = static_cast<size_t>(problem->r) * problem->c
+      * value_size;
+  try {
+    vector<char> values(num_bytes);
+    if (fread(&(values[0]), 1, num_bytes, f) != num_bytes) {
+      *error = "truncated amplitudes";
+      return false;
+    }
+    read_binary_values(&(values[0]), value_size, problem);
+  } catch (const bad_alloc&) {
+    problem->a.clear();
+    *error = "cannot allocate the amplitudes";
+    return false;
+  }
+  return true;
+}
+
+bool write_binary_problem(FILE* f, const EMDFlowInput& problem) {
+  fwrite("EMDF", 1, 4, f);
+  write_int32(f, problem.r);
+  write_int32(f, problem.c);
+  write_int32(f, problem.k);
+  write_int32(f, problem.emd_bound_low);
+  write_int32(f, problem.emd_bound_high);
+  write_int32(f, sizeof(double));
+  write_int32(f, problem.algorithm);
+  for (int row = 0; row < problem.r; ++row) {
+    fwrite(&(problem.a[row][0]), sizeof(double), problem.c, f);
+  }
+  return !ferror(f);
+}
+
+bool write_result_frame(FILE* f, int status,
+    const vector<vector<bool> >& support, int emd_cost, double amp_sum,
+    double final_lambda) {
+  int r = (status == 0) ? support.size() : 0;
+  int c = (r > 0) ? support[0].size() : 0;
+  fwrite("EMDR", 1, 4, f);
+  write_int32(f, status);
+  write_int32(f, r);
+  write_int32(f, c);
+  write_int32(f, emd_cost);
+  write_int32(f, 0);
+  fwrite(&amp_sum, sizeof(amp_sum), 1, f);
+  fwrite(&final_lambda, sizeof(final_lambda), 1, f);
+  if (r > 0) {
+    write_bits(f, support);
+  }
+  return !ferror(f);
+}
+
+SupportFormat parse_support_format(const string& name) {
+  if (name == "text") {
+    return kSupportText;
+  } else if (name == "bits") {
+    return kSupportBits;
+  } else if (name == "sparse") {
+    return kSupportSparse;
+  } else {
+    return kSupportUnknown;
+  }
+}
+
+void write_support(FILE* f, const vector<vector<bool> >& support,
+    SupportFormat format) {
+  int r = support.size();
+  int c = (r > 0) ? support[0].size() : 0;
+  if (format == kSupportText) {
+    string line(2 * c + 1, ' ');
+    line[2 * c] = '\n';
+    for (int row = 0; row < r; ++row) {
+      for (int col = 0; col < c; ++col) {
+        line[2 * col] = support[row][col] ? '1' : '0';
+      }
+      fwrite(line.data(), 1, line.size(), f);
+    }
+  } else if (format == kSupportBits) {
+    write_int32(f, r);
+    write_int32(f, c);
+    write_bits(f, support);
+  } else if (format == kSupportSparse) {
+    for (int row = 0; row < r; ++row) {
+      for (int col = 0; col < c; ++col) {
+        if (support[row][col]) {
+          fprintf(f, "%d %d\n", row, col);
+        }
+      }
+    }
+  }
+}
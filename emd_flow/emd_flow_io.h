@@ -0,0 +1,75 @@
+#ifndef __EMD_FLOW_IO_H__
+#define __EMD_FLOW_IO_H__
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Input and output formats of the emd_flow binary.
+
+struct EMDFlowInput {
+  int r;
+  int c;
+  int k;
+  int emd_bound_low;
+  int emd_bound_high;
+  // 0 for the default algorithm of the reader, otherwise 1 + the
+  // EMDFlowNetworkFactory::EMDFlowNetworkType (binary format only)
+  int algorithm;
+  // absolute values of the amplitudes
+  std::vector<std::vector<double> > a;
+};
+
+// Text format: "r c k emd_bound_low [emd_bound_high]" followed by the r * c
+// amplitudes in row-major order, all separated by whitespace.
+// emd_bound_high is only read if emd_interval is set (otherwise it is
+// emd_bound_low). The input is read in chunks and the numbers are parsed
+// with std::from_chars. Returns false and sets error for malformed input.
+bool read_text_problem(FILE* f, bool emd_interval, EMDFlowInput* problem,
+    std::string* error);
+
+// Binary format (little-endian): a 32-byte header with the magic "EMDF" and
+// the 32-bit integers r, c, k, emd_bound_low, emd_bound_high, value_size
+// and algorithm, followed by the r * c amplitudes in row-major order as
+// floats (value_size 4) or doubles (value_size 8). The file is
+// memory-mapped. Headers with more than kMaxBinaryValues amplitudes are
+// invalid, so a corrupt header cannot make the readers allocate arbitrary
+// amounts of memory.
+static const int kBinaryHeaderSize = 32;
+static const long long kMaxBinaryValues = 1LL << 27;
+bool read_binary_problem(const std::string& file_name,
+    EMDFlowInput* problem, std::string* error);
+// Reads the next problem in the binary format from a stream (e.g., a pipe
+// or a socket, see emd_flow_server.h). Returns false at the end of the
+// input (error is then empty) and for malformed or truncated problems or
+// if the amplitudes cannot be allocated.
+bool read_binary_frame(FILE* f, EMDFlowInput* problem, std::string* error);
+// Writes a problem in the binary format with doubles.
+bool write_binary_problem(FILE* f, const EMDFlowInput& problem);
+
+// Result of a problem of a binary stream: a 40-byte header with the magic
+// "EMDR" and the 32-bit integers status (see emd_flow_server.h), r, c,
+// emd_cost and 0, and the doubles amp_sum and final_lambda, followed by the
+// support in the bits format (without its r and c, r = c = 0 if status is
+// not 0).
+static const int kResultHeaderSize = 40;
+bool write_result_frame(FILE* f, int status,
+    const std::vector<std::vector<bool> >& support, int emd_cost,
+    double amp_sum, double final_lambda);
+
+enum SupportFormat {
+  // r lines of c entries 0 or 1
+  kSupportText,
+  // the 32-bit integers r and c (little-endian), followed by the entries in
+  // row-major order, 8 per byte starting with the least significant bit
+  kSupportBits,
+  // one line "row column" (0-based) per entry in the support, row-major
+  kSupportSparse,
+  kSupportUnknown
+};
+
+SupportFormat parse_support_format(const std::string& name);
+void write_support(FILE* f, const std::vector<std::vector<bool> >& support,
+    SupportFormat format);
+
+#endif
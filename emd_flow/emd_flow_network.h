@@ -3,6 +3,21 @@
 
 #include <vector>
 #include <string>
+#include <utility>
+#include <cstddef>
+
+#include "emd_flow_amplitudes.h"
+#include "emd_flow_stats.h"
+
+// Change of the optimal flow when its value increases by one unit (see
+// EMDFlowNetwork::run_flow_sweep). Entries are (row, column) pairs.
+struct EMDFlowSparsityStep {
+  // EMD and supported amplitude sum after this step
+  int emd_cost;
+  double amp_sum;
+  std::vector<std::pair<int, int> > added_entries;
+  std::vector<std::pair<int, int> > removed_entries;
+};
 
 class EMDFlowNetwork {
  public:
@@ -17,6 +32,35 @@ class EMDFlowNetwork {
   virtual int get_num_columns() = 0;
   virtual int get_num_rows() = 0;
   virtual void get_performance_diagnostics(std::string* s) { *s = "";}
+  // Sets the counters of the network since it was built (the statistics
+  // stay zero if the network has none).
+  virtual void get_statistics(EMDFlowNetworkStats* /*stats*/) { }
+  virtual void set_warm_start(bool /*warm_start*/) { }
+  virtual void set_blocking_flow(bool /*blocking_flow*/) { }
+  // Computes the optimal flows for the given lambda and all sparsities
+  // k = 1, ..., max_k (at most the number of rows) in one run and stores
+  // the change from k - 1 to k in (*steps)[k - 1]. Returns false if the
+  // network does not support this.
+  virtual bool run_flow_sweep(double /*lambda*/, int /*max_k*/,
+      std::vector<EMDFlowSparsityStep>* /*steps*/) {
+    return false;
+  }
+  // Returns a new network for the same amplitudes and options that can be
+  // used concurrently with this one, or NULL if the network does not
+  // support this. The clone starts without flow and with sparsity 0.
+  virtual EMDFlowNetwork* clone() {
+    return NULL;
+  }
+  // Replaces the amplitudes by a matrix of the same size, keeping the graph.
+  // If keep_flow is set and the network supports warm starts, the next
+  // run_flow re-optimizes the current flow for the new costs. Otherwise it
+  // computes a new flow from scratch. Returns false (and changes nothing) if
+  // the network does not support this or the size differs.
+  virtual bool update_amplitudes(
+      const EMDFlowAmplitudes& /*amplitudes*/,
+      bool /*keep_flow*/) {
+    return false;
+  }
   virtual ~EMDFlowNetwork() { }
 };
 
@@ -0,0 +1,361 @@
+#include "emd_flow_network_blocks.h"
+#include "emd_flow_candidates.h"
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+
+using namespace std;
+
+EMDFlowNetworkBlocks::EMDFlowNetworkBlocks(
+    const EMDFlowAmplitudes& amplitudes,
+    EMDFlowNetworkFactory::EMDFlowNetworkType type, int max_shift,
+    bool integer_costs, int num_blocks, int num_threads)
+    : k_(0), max_shift_(max_shift), type_(type),
+    integer_costs_(integer_costs), num_threads_(max(num_threads, 1)),
+    emd_cost_(0), amp_sum_(0.0), num_block_runs(0), num_price_iterations(0),
+    num_agreed_runs(0), num_repair_runs(0) {
+  r_ = amplitudes.num_rows();
+  c_ = amplitudes.num_columns();
+  a_.assign(r_, vector<double>(c_));
+  for (int row = 0; row < r_; ++row) {
+    for (int col = 0; col < c_; ++col) {
+      a_[row][col] = abs(amplitudes(row, col));
+    }
+  }
+
+  // every block needs at least two columns
+  num_blocks = max(1, min(num_blocks, c_ - 1));
+  first_column_.resize(num_blocks + 1);
+  for (int b = 0; b <= num_blocks; ++b) {
+    first_column_[b] = static_cast<int>(
+        static_cast<long long>(b) * (c_ - 1) / num_blocks);
+  }
+  prices_.assign(num_blocks - 1, vector<double>(r_, 0.0));
+  stale_.assign(num_blocks, false);
+  block_support_.resize(num_blocks);
+  replaced_block_stats_.resize(num_blocks);
+  blocks_.resize(num_blocks);
+  for (int b = 0; b < num_blocks; ++b) {
+    vector<vector<double> > block_amplitudes;
+    get_block_amplitudes(b, &block_amplitudes);
+    blocks_[b] = EMDFlowNetworkFactory::create_EMD_flow_network(
+        block_amplitudes, type_, max_shift_, integer_costs_).release();
+  }
+}
+
+EMDFlowNetworkBlocks::~EMDFlowNetworkBlocks() {
+  for (size_t b = 0; b < blocks_.size(); ++b) {
+    delete blocks_[b];
+  }
+}
+
+// The shared column of blocks b and b + 1 gets a / 2 + p + M in block b and
+// a / 2 - p + M in block b + 1, where M is the largest |p| of the column.
+void EMDFlowNetworkBlocks::get_block_amplitudes(int block,
+    vector<vector<double> >* amplitudes) {
+  int first = first_column_[block];
+  int last = first_column_[block + 1];
+  amplitudes->assign(r_, vector<double>(last - first + 1));
+  for (int row = 0; row < r_; ++row) {
+    for (int col = first; col <= last; ++col) {
+      (*amplitudes)[row][col - first] = a_[row][col];
+    }
+  }
+
+  if (block > 0) {
+    const vector<double>& p = prices_[block - 1];
+    double offset = 0.0;
+    for (int row = 0; row < r_; ++row) {
+      offset = max(offset, abs(p[row]));
+    }
+    for (int row = 0; row < r_; ++row) {
+      (*amplitudes)[row][0] = a_[row][first] / 2 - p[row] + offset;
+    }
+  }
+  if (block < num_blocks() - 1) {
+    const vector<double>& p = prices_[block];
+    double offset = 0.0;
+    for (int row = 0; row < r_; ++row) {
+      offset = max(offset, abs(p[row]));
+    }
+    for (int row = 0; row < r_; ++row) {
+      (*amplitudes)[row][last - first] = a_[row][last] / 2 + p[row] + offset;
+    }
+  }
+}
+
+void EMDFlowNetworkBlocks::set_sparsity(int k) {
+  k_ = k;
+  for (int b = 0; b < num_blocks(); ++b) {
+    blocks_[b]->set_sparsity(k);
+  }
+  if (repair_.get() != NULL) {
+    repair_->set_sparsity(k);
+  }
+}
+
+// Only touches the state of the block, so blocks can be replaced
+// concurrently.
+void EMDFlowNetworkBlocks::replace_block(int block,
+    const EMDFlowAmplitudes& amplitudes) {
+  if (EMD_FLOW_STATS) {
+    EMDFlowNetworkStats block_stats;
+    blocks_[block]->get_statistics(&block_stats);
+    replaced_block_stats_[block].add(block_stats);
+  }
+  delete blocks_[block];
+  blocks_[block] = EMDFlowNetworkFactory::create_EMD_flow_network(
+      amplitudes, type_, max_shift_, integer_costs_).release();
+  blocks_[block]->set_sparsity(k_);
+}
+
+void EMDFlowNetworkBlocks::run_block_range(double lambda,
+    const vector<int>* blocks, int first, int step) {
+  for (size_t ii = first; ii < blocks->size(); ii += step) {
+    int b = (*blocks)[ii];
+    if (stale_[b]) {
+      vector<vector<double> > block_amplitudes;
+      get_block_amplitudes(b, &block_amplitudes);
+      if (!blocks_[b]->update_amplitudes(block_amplitudes, true)) {
+        replace_block(b, block_amplitudes);
+      }
+      stale_[b] = false;
+    }
+    blocks_[b]->run_flow(lambda);
+    blocks_[b]->get_support(&(block_support_[b]));
+  }
+}
+
+// Runs the given blocks on up to num_threads_ threads.
+void EMDFlowNetworkBlocks::run_blocks(double lambda,
+    const vector<int>& blocks) {
+  int num_workers = min(num_threads_, static_cast<int>(blocks.size()));
+  vector<thread> threads;
+  for (int ii = 1; ii < num_workers; ++ii) {
+    threads.push_back(thread(&EMDFlowNetworkBlocks::run_block_range, this,
+        lambda, &blocks, ii, num_workers));
+  }
+  run_block_range(lambda, &blocks, 0, max(num_workers, 1));
+  for (size_t ii = 0; ii < threads.size(); ++ii) {
+    threads[ii].join();
+  }
+  num_block_runs += blocks.size();
+}
+
+void EMDFlowNetworkBlocks::run_flow(double lambda) {
+  vector<int> blocks;
+  for (int b = 0; b < num_blocks(); ++b) {
+    blocks.push_back(b);
+  }
+
+  for (int iter = 0; ; ++iter) {
+    run_blocks(lambda, blocks);
+
+    // Subgradient step on the disagreeing rows of every shared column. The
+    // step is on the scale of the amplitudes of the column and decreases
+    // with the number of rounds.
+    vector<bool> changed(num_blocks(), false);
+    for (int b = 0; b < num_blocks() - 1; ++b) {
+      int col = first_column_[b + 1];
+      const vector<vector<bool> >& left = block_support_[b];
+      const vector<vector<bool> >& right = block_support_[b + 1];
+      int left_col = col - first_column_[b];
+      double max_amplitude = 0.0;
+      for (int row = 0; row < r_; ++row) {
+        max_amplitude = max(max_amplitude, a_[row][col]);
+      }
+      double step = (max_amplitude / 2 + lambda) / (iter + 1);
+      for (int row = 0; row < r_; ++row) {
+        if (left[row][left_col] == right[row][0]) {
+          continue;
+        }
+        // the left block uses row too much: make it cheaper on the left
+        prices_[b][row] += left[row][left_col] ? -step : step;
+        changed[b] = true;
+        changed[b + 1] = true;
+      }
+    }
+
+    blocks.clear();
+    for (int b = 0; b < num_blocks(); ++b) {
+      if (changed[b]) {
+        blocks.push_back(b);
+        stale_[b] = true;
+      }
+    }
+    if (blocks.empty()) {
+      stitch_blocks();
+      num_agreed_runs += 1;
+      return;
+    }
+    if (iter + 1 >= kMaxPriceIterations) {
+      run_repair(lambda);
+      return;
+    }
+    num_price_iterations += 1;
+  }
+}
+
+void EMDFlowNetworkBlocks::stitch_blocks() {
+  support_.assign(r_, vector<bool>(c_, false));
+  emd_cost_ = 0;
+  for (int b = 0; b < num_blocks(); ++b) {
+    int first = first_column_[b];
+    int last = first_column_[b + 1];
+    for (int row = 0; row < r_; ++row) {
+      for (int col = first; col <= last; ++col) {
+        if (block_support_[b][row][col - first]) {
+          support_[row][col] = true;
+        }
+      }
+    }
+    emd_cost_ += blocks_[b]->get_EMD_used();
+  }
+  amp_sum_ = 0.0;
+  for (int row = 0; row < r_; ++row) {
+    for (int col = 0; col < c_; ++col) {
+      if (support_[row][col]) {
+        amp_sum_ += a_[row][col];
+      }
+    }
+  }
+}
+
+// Solves the full problem with a SAP network on the k heavy rows and the
+// union of the block supports. The network verifies the pruned entries, so
+// the result is optimal. The candidate set of the network only grows, so the
+// network is kept for the following runs.
+void EMDFlowNetworkBlocks::run_repair(double lambda) {
+  num_repair_runs += 1;
+  if (repair_.get() == NULL) {
+    EMDFlowCandidates candidates;
+    select_EMD_flow_candidates(a_, k_, 0, max_shift_, true, &candidates);
+    for (int b = 0; b < num_blocks(); ++b) {
+      int first = first_column_[b];
+      int last = first_column_[b + 1];
+      for (int row = 0; row < r_; ++row) {
+        for (int col = first; col <= last; ++col) {
+          if (block_support_[b][row][col - first]) {
+            candidates.mask[row][col] = true;
+          }
+        }
+      }
+    }
+    close_EMD_flow_candidates(max_shift_, &candidates.mask);
+    EMDFlowNetworkFactory::EMDFlowNetworkType type = type_;
+    if (type != EMDFlowNetworkFactory::kShortestAugmentingPath
+        && type != EMDFlowNetworkFactory::kShortestAugmentingPathBinaryHeap
+        && type != EMDFlowNetworkFactory::kShortestAugmentingPathPairingHeap
+        && type
+            != EMDFlowNetworkFactory::kShortestAugmentingPathBlockingFlow) {
+      type = EMDFlowNetworkFactory::kShortestAugmentingPath;
+    }
+    repair_ = EMDFlowNetworkFactory::create_EMD_flow_network(a_, type,
+        max_shift_, integer_costs_, candidates);
+    repair_->set_sparsity(k_);
+  }
+  repair_->run_flow(lambda);
+  repair_->get_support(&support_);
+  emd_cost_ = repair_->get_EMD_used();
+  amp_sum_ = repair_->get_supported_amplitude_sum();
+}
+
+int EMDFlowNetworkBlocks::get_EMD_used() {
+  return emd_cost_;
+}
+
+double EMDFlowNetworkBlocks::get_supported_amplitude_sum() {
+  return amp_sum_;
+}
+
+void EMDFlowNetworkBlocks::get_support(vector<vector<bool> >* support) {
+  *support = support_;
+}
+
+int EMDFlowNetworkBlocks::get_num_nodes() {
+  int num_nodes = 0;
+  for (int b = 0; b < num_blocks(); ++b) {
+    num_nodes += blocks_[b]->get_num_nodes();
+  }
+  return num_nodes;
+}
+
+int EMDFlowNetworkBlocks::get_num_edges() {
+  int num_edges = 0;
+  for (int b = 0; b < num_blocks(); ++b) {
+    num_edges += blocks_[b]->get_num_edges();
+  }
+  return num_edges;
+}
+
+int EMDFlowNetworkBlocks::get_num_columns() {
+  return c_;
+}
+
+int EMDFlowNetworkBlocks::get_num_rows() {
+  return r_;
+}
+
+void EMDFlowNetworkBlocks::get_performance_diagnostics(string* s) {
+  const size_t tmp_size = 2000;
+  char tmp[tmp_size];
+  snprintf(tmp, tmp_size, "Column blocks: %d\n"
+      "Block runs: %lld\n"
+      "Price iterations: %lld\n"
+      "Agreed runs: %lld\n"
+      "Repair runs: %lld\n", num_blocks(), num_block_runs,
+      num_price_iterations, num_agreed_runs, num_repair_runs);
+  *s = string(tmp);
+  if (repair_.get() != NULL) {
+    string repair_diagnostics;
+    repair_->get_performance_diagnostics(&repair_diagnostics);
+    *s += "Repair network:\n" + repair_diagnostics;
+  }
+}
+
+void EMDFlowNetworkBlocks::get_statistics(EMDFlowNetworkStats* stats) {
+  *stats = replaced_repair_stats_;
+  for (int b = 0; b < num_blocks(); ++b) {
+    EMDFlowNetworkStats block_stats;
+    blocks_[b]->get_statistics(&block_stats);
+    stats->add(block_stats);
+    stats->add(replaced_block_stats_[b]);
+  }
+  if (repair_.get() != NULL) {
+    EMDFlowNetworkStats repair_stats;
+    repair_->get_statistics(&repair_stats);
+    stats->add(repair_stats);
+  }
+}
+
+bool EMDFlowNetworkBlocks::update_amplitudes(
+    const EMDFlowAmplitudes& amplitudes, bool keep_flow) {
+  if (amplitudes.num_rows() != r_ || amplitudes.num_columns() != c_) {
+    return false;
+  }
+  for (int row = 0; row < r_; ++row) {
+    for (int col = 0; col < c_; ++col) {
+      a_[row][col] = abs(amplitudes(row, col));
+    }
+  }
+  for (int b = 0; b < num_blocks(); ++b) {
+    vector<vector<double> > block_amplitudes;
+    get_block_amplitudes(b, &block_amplitudes);
+    if (!blocks_[b]->update_amplitudes(block_amplitudes, keep_flow)) {
+      replace_block(b, block_amplitudes);
+    }
+    stale_[b] = false;
+  }
+  if (repair_.get() != NULL && !repair_->update_amplitudes(amplitudes,
+      keep_flow)) {
+    if (EMD_FLOW_STATS) {
+      EMDFlowNetworkStats repair_stats;
+      repair_->get_statistics(&repair_stats);
+      replaced_repair_stats_.add(repair_stats);
+    }
+    repair_.reset();
+  }
+  return true;
+}
@@ -0,0 +1,107 @@
+#ifndef __EMD_FLOW_NETWORK_BLOCKS_H__
+#define __EMD_FLOW_NETWORK_BLOCKS_H__
+
+#include "emd_flow_network.h"
+#include "emd_flow_network_factory.h"
+
+#include <vector>
+#include <memory>
+#include <string>
+
+// Column-block decomposition for very wide matrices. The columns are split
+// into num_blocks blocks, and neighbouring blocks share one column. Every
+// block is an independent network of the given type, so the blocks can be
+// solved in parallel (on num_threads threads). The amplitudes of a shared
+// column are split between the two blocks, and the left block gets a price
+// p(row) added to its half, the right block subtracted. If both blocks then
+// choose the same k rows in every shared column, the block solutions form a
+// flow whose objective equals the sum of the block objectives, which is an
+// upper bound for the optimum (Lagrangian relaxation of the shared column),
+// so the stitched flow is optimal. Otherwise the prices of the disagreeing
+// rows are moved towards agreement (subgradient steps) and the affected
+// blocks are solved again (warm-started, see update_amplitudes). After
+// kMaxPriceIterations rounds without agreement, the network falls back to
+// a global repair network: a SAP network on the union of the block
+// supports that verifies the pruned entries (see emd_flow_candidates.h), so
+// the result is always optimal.
+// Every flow uses exactly k entries of every column, so adding a constant
+// to a column does not change the optimal flow. The shared columns get such
+// an offset to keep the amplitudes of the blocks non-negative.
+class EMDFlowNetworkBlocks : public EMDFlowNetwork {
+ public:
+  static const int kMaxPriceIterations = 20;
+
+  EMDFlowNetworkBlocks(const EMDFlowAmplitudes& amplitudes,
+      EMDFlowNetworkFactory::EMDFlowNetworkType type, int max_shift,
+      bool integer_costs, int num_blocks, int num_threads);
+  void set_sparsity(int k);
+  void run_flow(double lambda);
+  int get_EMD_used();
+  double get_supported_amplitude_sum();
+  void get_support(std::vector<std::vector<bool> >* support);
+  int get_num_nodes();
+  int get_num_edges();
+  int get_num_columns();
+  int get_num_rows();
+  void get_performance_diagnostics(std::string* s);
+  void get_statistics(EMDFlowNetworkStats* stats);
+  bool update_amplitudes(const EMDFlowAmplitudes& amplitudes,
+      bool keep_flow);
+  ~EMDFlowNetworkBlocks();
+
+ private:
+  // absolute values of the amplitudes
+  std::vector<std::vector<double> > a_;
+  int r_;
+  int c_;
+  int k_;
+  int max_shift_;
+  EMDFlowNetworkFactory::EMDFlowNetworkType type_;
+  bool integer_costs_;
+  int num_threads_;
+
+  // block b covers the columns first_column_[b], ..., first_column_[b + 1]
+  std::vector<int> first_column_;
+  std::vector<EMDFlowNetwork*> blocks_;
+  // prices_[b][row] is the price of row in the column shared by blocks b
+  // and b + 1
+  std::vector<std::vector<double> > prices_;
+  // true if the amplitudes of block b have to be updated before its next run
+  std::vector<bool> stale_;
+  std::vector<std::vector<std::vector<bool> > > block_support_;
+
+  std::auto_ptr<EMDFlowNetwork> repair_;
+  // statistics of the replaced networks of every block and of the replaced
+  // repair networks
+  std::vector<EMDFlowNetworkStats> replaced_block_stats_;
+  EMDFlowNetworkStats replaced_repair_stats_;
+
+  std::vector<std::vector<bool> > support_;
+  int emd_cost_;
+  double amp_sum_;
+
+  long long num_block_runs;
+  long long num_price_iterations;
+  long long num_agreed_runs;
+  long long num_repair_runs;
+
+  int num_blocks() {
+    return blocks_.size();
+  }
+
+  void get_block_amplitudes(int block,
+      std::vector<std::vector<double> >* amplitudes);
+  // Replaces the network of a block by a new one for the given amplitudes.
+  void replace_block(int block,
+      const EMDFlowAmplitudes& amplitudes);
+  void run_blocks(double lambda, const std::vector<int>& blocks);
+  void run_block_range(double lambda, const std::vector<int>* blocks,
+      int first, int step);
+  void stitch_blocks();
+  void run_repair(double lambda);
+
+  EMDFlowNetworkBlocks(const EMDFlowNetworkBlocks&);
+  EMDFlowNetworkBlocks& operator=(const EMDFlowNetworkBlocks&);
+};
+
+#endif
@@ -0,0 +1,325 @@
+#include "emd_flow_network_dp.h"
+#include "emd_flow_network_sap.h"
+#include "distance_transform.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+bool EMDFlowNetworkDP::use_dynamic_program(int num_rows, int num_columns,
+    int k) {
+  if (k > kMaxSparsity || k > num_rows) {
+    return false;
+  }
+  if (k < 2) {
+    return true;
+  }
+  double num_states = static_cast<double>(num_rows) * (num_rows - 1) / 2;
+  return num_states * num_columns <= kMaxTableSize;
+}
+
+EMDFlowNetworkDP::EMDFlowNetworkDP(
+    const EMDFlowAmplitudes& amplitudes, int max_shift)
+    : k_(0), max_shift_(max_shift), num_states_(0), use_fallback_(false),
+    num_dp_runs(0), num_table_entries(0) {
+  r_ = amplitudes.num_rows();
+  c_ = amplitudes.num_columns();
+
+  a_.resize(r_ * c_);
+  for (int row = 0; row < r_; ++row) {
+    for (int col = 0; col < c_; ++col) {
+      a_[col * r_ + row] = abs(amplitudes(row, col));
+    }
+  }
+}
+
+void EMDFlowNetworkDP::set_sparsity(int k) {
+  k_ = k;
+  path_rows_.clear();
+  use_fallback_ = !use_dynamic_program(r_, c_, k);
+  if (use_fallback_) {
+    if (fallback_.get() == NULL) {
+      fallback_.reset(new EMDFlowNetworkSAP<IndexedDaryHeap<4, double> >(
+          get_amplitudes(), max_shift_));
+    }
+    fallback_->set_sparsity(k);
+    return;
+  }
+
+  if (k == 0) {
+    num_states_ = 0;
+  } else if (k == 1) {
+    num_states_ = r_;
+  } else {
+    num_states_ = static_cast<size_t>(r_) * (r_ - 1) / 2;
+  }
+  value_.resize(num_states_ * c_);
+  if (k == 2) {
+    transform_.resize(static_cast<size_t>(r_) * r_);
+    tmp_in_.resize(r_);
+  }
+  tmp_.resize(r_);
+}
+
+void EMDFlowNetworkDP::run_flow(double lambda) {
+  if (use_fallback_) {
+    fallback_->run_flow(lambda);
+    return;
+  }
+  path_rows_.assign(k_ * c_, 0);
+  if (k_ == 1) {
+    run_dp_single(lambda);
+  } else if (k_ == 2) {
+    run_dp_pair(lambda);
+  }
+  ++num_dp_runs;
+  num_table_entries += num_states_ * c_;
+}
+
+// value(row, col) = min_prev value(prev, col - 1) + lambda * |prev - row|
+//                   - a(row, col)
+void EMDFlowNetworkDP::run_dp_single(double lambda) {
+  for (int row = 0; row < r_; ++row) {
+    value_[row] = -a_[row];
+  }
+  for (int col = 1; col < c_; ++col) {
+    const double* prev = &(value_[(col - 1) * r_]);
+    double* cur = &(value_[col * r_]);
+    distance_transform(prev, r_, lambda, max_shift_, &(tmp_[0]), NULL,
+        &queue_);
+    for (int row = 0; row < r_; ++row) {
+      cur[row] = tmp_[row] - a_[col * r_ + row];
+    }
+  }
+
+  // backtrack: the best predecessor of the chosen row is recomputed, which
+  // is cheaper than storing it
+  int window = (max_shift_ < 0) ? r_ : max_shift_;
+  const double* last = &(value_[(c_ - 1) * r_]);
+  int row = min_element(last, last + r_) - last;
+  path_rows_[c_ - 1] = row;
+  for (int col = c_ - 1; col > 0; --col) {
+    const double* prev = &(value_[(col - 1) * r_]);
+    int best = row;
+    double best_value = numeric_limits<double>::infinity();
+    for (int ii = max(row - window, 0); ii <= min(row + window, r_ - 1);
+        ++ii) {
+      double cur_value = prev[ii] + lambda * abs(ii - row);
+      if (cur_value < best_value) {
+        best_value = cur_value;
+        best = ii;
+      }
+    }
+    row = best;
+    path_rows_[col - 1] = row;
+  }
+}
+
+// The transition for a state (row1, row2) is a two-dimensional distance
+// transform over the states (prev1, prev2) with prev1 < prev2. It is split
+// into a transform over prev2 > prev1 for every prev1 (the states with the
+// same prev1 are contiguous) and a transform over prev1 without the
+// ordering constraint. The shift window applies to both rows separately, so
+// it is also separable.
+void EMDFlowNetworkDP::run_dp_pair(double lambda) {
+  for (int row1 = 0; row1 < r_ - 1; ++row1) {
+    for (int row2 = row1 + 1; row2 < r_; ++row2) {
+      value_[state_index(row1, row2)] = -a_[row1] - a_[row2];
+    }
+  }
+  for (int col = 1; col < c_; ++col) {
+    const double* prev = &(value_[(col - 1) * num_states_]);
+    double* cur = &(value_[col * num_states_]);
+    const double* amps = &(a_[col * r_]);
+
+    // transform_[row2 * r + prev1] = min_{prev2 > prev1} value(prev1, prev2)
+    //                                + lambda * |prev2 - row2|
+    for (int prev1 = 0; prev1 < r_ - 1; ++prev1) {
+      fill(tmp_in_.begin(), tmp_in_.begin() + prev1 + 1,
+          numeric_limits<double>::infinity());
+      copy(prev + state_index(prev1, prev1 + 1),
+          prev + state_index(prev1 + 1, prev1 + 2),
+          tmp_in_.begin() + prev1 + 1);
+      distance_transform(&(tmp_in_[0]), r_, lambda, max_shift_, &(tmp_[0]),
+          NULL, &queue_);
+      for (int row2 = 0; row2 < r_; ++row2) {
+        transform_[row2 * r_ + prev1] = tmp_[row2];
+      }
+    }
+
+    for (int row2 = 1; row2 < r_; ++row2) {
+      distance_transform(&(transform_[row2 * r_]), r_ - 1, lambda,
+          max_shift_, &(tmp_[0]), NULL, &queue_);
+      for (int row1 = 0; row1 < row2; ++row1) {
+        cur[state_index(row1, row2)] = tmp_[row1] - amps[row1] - amps[row2];
+      }
+    }
+  }
+
+  const double* last = &(value_[(c_ - 1) * num_states_]);
+  size_t best_state = min_element(last, last + num_states_) - last;
+  int row1 = 0;
+  int row2 = 1;
+  for (int prev1 = 0; prev1 < r_ - 1; ++prev1) {
+    if (best_state < state_index(prev1 + 1, prev1 + 2)) {
+      row1 = prev1;
+      row2 = best_state - state_index(prev1, prev1 + 1) + prev1 + 1;
+      break;
+    }
+  }
+  path_rows_[2 * (c_ - 1)] = row1;
+  path_rows_[2 * (c_ - 1) + 1] = row2;
+  int window = (max_shift_ < 0) ? r_ : max_shift_;
+  for (int col = c_ - 1; col > 0; --col) {
+    const double* prev = &(value_[(col - 1) * num_states_]);
+    int best1 = row1;
+    int best2 = row2;
+    double best_value = numeric_limits<double>::infinity();
+    for (int prev1 = max(row1 - window, 0);
+        prev1 <= min(row1 + window, r_ - 2); ++prev1) {
+      const double* values = prev + state_index(prev1, prev1 + 1);
+      double cost1 = lambda * abs(prev1 - row1);
+      for (int prev2 = max(row2 - window, prev1 + 1);
+          prev2 <= min(row2 + window, r_ - 1); ++prev2) {
+        double cur_value = values[prev2 - prev1 - 1] + cost1
+            + lambda * abs(prev2 - row2);
+        if (cur_value < best_value) {
+          best_value = cur_value;
+          best1 = prev1;
+          best2 = prev2;
+        }
+      }
+    }
+    row1 = best1;
+    row2 = best2;
+    path_rows_[2 * (col - 1)] = row1;
+    path_rows_[2 * (col - 1) + 1] = row2;
+  }
+}
+
+int EMDFlowNetworkDP::get_EMD_used() {
+  if (use_fallback_) {
+    return fallback_->get_EMD_used();
+  }
+  int emd_cost = 0;
+  if (path_rows_.empty()) {
+    return 0;
+  }
+  for (int col = 0; col < c_ - 1; ++col) {
+    for (int ii = 0; ii < k_; ++ii) {
+      emd_cost += abs(path_rows_[col * k_ + ii]
+          - path_rows_[(col + 1) * k_ + ii]);
+    }
+  }
+  return emd_cost;
+}
+
+double EMDFlowNetworkDP::get_supported_amplitude_sum() {
+  if (use_fallback_) {
+    return fallback_->get_supported_amplitude_sum();
+  }
+  double amp_sum = 0;
+  if (path_rows_.empty()) {
+    return 0;
+  }
+  for (int col = 0; col < c_; ++col) {
+    for (int ii = 0; ii < k_; ++ii) {
+      amp_sum += a_[col * r_ + path_rows_[col * k_ + ii]];
+    }
+  }
+  return amp_sum;
+}
+
+void EMDFlowNetworkDP::get_support(
+    std::vector<std::vector<bool> >* support) {
+  if (use_fallback_) {
+    fallback_->get_support(support);
+    return;
+  }
+  support->resize(r_);
+  for (int row = 0; row < r_; ++row) {
+    (*support)[row].assign(c_, false);
+  }
+  if (path_rows_.empty()) {
+    return;
+  }
+  for (int col = 0; col < c_; ++col) {
+    for (int ii = 0; ii < k_; ++ii) {
+      (*support)[path_rows_[col * k_ + ii]][col] = true;
+    }
+  }
+}
+
+int EMDFlowNetworkDP::get_num_nodes() {
+  if (use_fallback_) {
+    return fallback_->get_num_nodes();
+  }
+  // entries of the table
+  return num_states_ * c_;
+}
+
+int EMDFlowNetworkDP::get_num_edges() {
+  if (use_fallback_) {
+    return fallback_->get_num_edges();
+  }
+  return 0;
+}
+
+int EMDFlowNetworkDP::get_num_columns() {
+  return c_;
+}
+
+int EMDFlowNetworkDP::get_num_rows() {
+  return r_;
+}
+
+void EMDFlowNetworkDP::get_performance_diagnostics(std::string* s) {
+  const size_t tmp_size = 2000;
+  char tmp[tmp_size];
+  snprintf(tmp, tmp_size, "Dynamic program runs: %lld\n"
+      "Table entries: %lld\n", num_dp_runs, num_table_entries);
+  *s = string(tmp);
+  if (fallback_.get() != NULL) {
+    string fallback_diagnostics;
+    fallback_->get_performance_diagnostics(&fallback_diagnostics);
+    *s += "SAP network for large k:\n" + fallback_diagnostics;
+  }
+}
+
+// The dynamic program has no Dijkstra counters, only the SAP network for
+// large k.
+void EMDFlowNetworkDP::get_statistics(EMDFlowNetworkStats* stats) {
+  if (fallback_.get() != NULL) {
+    fallback_->get_statistics(stats);
+  }
+}
+
+EMDFlowAmplitudes EMDFlowNetworkDP::get_amplitudes() {
+  return EMDFlowAmplitudes(&(a_[0]), r_, c_, 1, r_);
+}
+
+EMDFlowNetwork* EMDFlowNetworkDP::clone() {
+  return new EMDFlowNetworkDP(get_amplitudes(), max_shift_);
+}
+
+bool EMDFlowNetworkDP::update_amplitudes(
+    const EMDFlowAmplitudes& amplitudes, bool keep_flow) {
+  if (amplitudes.num_rows() != r_ || amplitudes.num_columns() != c_) {
+    return false;
+  }
+  // the dynamic program has no state to keep
+  if (fallback_.get() != NULL) {
+    fallback_->update_amplitudes(amplitudes, keep_flow);
+  }
+  for (int row = 0; row < r_; ++row) {
+    for (int col = 0; col < c_; ++col) {
+      a_[col * r_ + row] = abs(amplitudes(row, col));
+    }
+  }
+  path_rows_.clear();
+  return true;
+}
@@ -2,6 +2,8 @@
 #include "emd_flow_network.h"
 #include "emd_flow_network_lemon.h"
 #include "emd_flow_network_sap.h"
+#include "emd_flow_network_sap_l1.h"
+#include "emd_flow_network_dp.h"
 
 #include <memory>
 
@@ -12,27 +14,97 @@
 using namespace std;
 using namespace lemon;
 
-auto_ptr<EMDFlowNetwork> EMDFlowNetworkFactory::create_EMD_flow_network(
-        const vector<vector<double> >& amplitudes, EMDFlowNetworkType type) {
-  if (type == kLemonCostScaling) {
+namespace {
+
+// networks with costs of type Cost, "sap" uses DefaultQueue
+template <typename Cost, typename DefaultQueue>
+auto_ptr<EMDFlowNetwork> create_network(
+    const EMDFlowAmplitudes& amplitudes,
+    EMDFlowNetworkFactory::EMDFlowNetworkType type, int max_shift,
+    const EMDFlowCandidates& candidates) {
+  typedef EMDFlowNetworkFactory F;
+  if (type == F::kLemonCostScaling) {
+    return auto_ptr<EMDFlowNetwork>(
+        new EMDFlowNetworkLemon<CostScaling<ListDigraph, int, Cost> >(
+            amplitudes, max_shift, false));
+  } else if (type == F::kLemonNetworkSimplex) {
+    return auto_ptr<EMDFlowNetwork>(
+        new EMDFlowNetworkLemon<NetworkSimplex<ListDigraph, int, Cost> >(
+            amplitudes, max_shift, false));
+  } else if (type == F::kLemonCapacityScaling) {
+    return auto_ptr<EMDFlowNetwork>(
+        new EMDFlowNetworkLemon<CapacityScaling<ListDigraph, int, Cost> >(
+            amplitudes, max_shift, false));
+  } else if (type == F::kLemonCostScalingChain) {
     return auto_ptr<EMDFlowNetwork>(
-        new EMDFlowNetworkLemon<CostScaling<ListDigraph, int, double> >(
-            amplitudes));
-  } else if (type == kLemonNetworkSimplex) {
+        new EMDFlowNetworkLemon<CostScaling<ListDigraph, int, Cost> >(
+            amplitudes, max_shift, true));
+  } else if (type == F::kLemonNetworkSimplexChain) {
     return auto_ptr<EMDFlowNetwork>(
-        new EMDFlowNetworkLemon<NetworkSimplex<ListDigraph, int, double> >(
-            amplitudes));
-  } else if (type == kLemonCapacityScaling) {
+        new EMDFlowNetworkLemon<NetworkSimplex<ListDigraph, int, Cost> >(
+            amplitudes, max_shift, true));
+  } else if (type == F::kLemonCapacityScalingChain) {
     return auto_ptr<EMDFlowNetwork>(
-        new EMDFlowNetworkLemon<CapacityScaling<ListDigraph, int, double> >(
-            amplitudes));
-  } else if (type == kShortestAugmentingPath) {
-    return auto_ptr<EMDFlowNetwork>(new EMDFlowNetworkSAP(amplitudes));
+        new EMDFlowNetworkLemon<CapacityScaling<ListDigraph, int, Cost> >(
+            amplitudes, max_shift, true));
+  } else if (type == F::kShortestAugmentingPath) {
+    return auto_ptr<EMDFlowNetwork>(
+        new EMDFlowNetworkSAP<DefaultQueue>(amplitudes, max_shift,
+            candidates));
+  } else if (type == F::kShortestAugmentingPathBinaryHeap) {
+    return auto_ptr<EMDFlowNetwork>(
+        new EMDFlowNetworkSAP<LazyBinaryHeap<Cost> >(amplitudes, max_shift,
+            candidates));
+  } else if (type == F::kShortestAugmentingPathPairingHeap) {
+    return auto_ptr<EMDFlowNetwork>(
+        new EMDFlowNetworkSAP<PairingHeap<Cost> >(amplitudes, max_shift,
+            candidates));
+  } else if (type == F::kShortestAugmentingPathBlockingFlow) {
+    auto_ptr<EMDFlowNetwork> network(
+        new EMDFlowNetworkSAP<DefaultQueue>(amplitudes, max_shift,
+            candidates));
+    network->set_blocking_flow(true);
+    return network;
+  } else if (type == F::kShortestAugmentingPathL1) {
+    return auto_ptr<EMDFlowNetwork>(new EMDFlowNetworkSAPL1(amplitudes));
+  } else if (type == F::kDynamicProgram) {
+    return auto_ptr<EMDFlowNetwork>(
+        new EMDFlowNetworkDP(amplitudes, max_shift));
   } else {
     return auto_ptr<EMDFlowNetwork>();
   }
 }
 
+bool is_lemon_type(EMDFlowNetworkFactory::EMDFlowNetworkType type) {
+  typedef EMDFlowNetworkFactory F;
+  return type == F::kLemonCostScaling || type == F::kLemonNetworkSimplex
+      || type == F::kLemonCapacityScaling || type == F::kLemonCostScalingChain
+      || type == F::kLemonNetworkSimplexChain
+      || type == F::kLemonCapacityScalingChain;
+}
+
+}  // namespace
+
+auto_ptr<EMDFlowNetwork> EMDFlowNetworkFactory::create_EMD_flow_network(
+        const EMDFlowAmplitudes& amplitudes, EMDFlowNetworkType type,
+        int max_shift, bool integer_costs) {
+  return create_EMD_flow_network(amplitudes, type, max_shift, integer_costs,
+      EMDFlowCandidates());
+}
+
+auto_ptr<EMDFlowNetwork> EMDFlowNetworkFactory::create_EMD_flow_network(
+        const EMDFlowAmplitudes& amplitudes, EMDFlowNetworkType type,
+        int max_shift, bool integer_costs,
+        const EMDFlowCandidates& candidates) {
+  if (integer_costs || is_lemon_type(type)) {
+    return create_network<long long, RadixHeap>(amplitudes, type, max_shift,
+        candidates);
+  } else {
+    return create_network<double, IndexedDaryHeap<4, double> >(amplitudes,
+        type, max_shift, candidates);
+  }
+}
+
 EMDFlowNetworkFactory::EMDFlowNetworkType EMDFlowNetworkFactory::parse_type(
     const std::string& name) {
   if (name == "lemon-costscaling") {
@@ -41,8 +113,24 @@ EMDFlowNetworkFactory::EMDFlowNetworkType EMDFlowNetworkFactory::parse_type(
     return kLemonNetworkSimplex;
   } else if (name == "lemon-capacityscaling") {
     return kLemonCapacityScaling;
+  } else if (name == "lemon-costscaling-chain") {
+    return kLemonCostScalingChain;
+  } else if (name == "lemon-networksimplex-chain") {
+    return kLemonNetworkSimplexChain;
+  } else if (name == "lemon-capacityscaling-chain") {
+    return kLemonCapacityScalingChain;
   } else if (name == "sap" || name == "shortest-augmenting-path") {
     return kShortestAugmentingPath;
+  } else if (name == "sap-binaryheap") {
+    return kShortestAugmentingPathBinaryHeap;
+  } else if (name == "sap-pairingheap") {
+    return kShortestAugmentingPathPairingHeap;
+  } else if (name == "sap-blockingflow") {
+    return kShortestAugmentingPathBlockingFlow;
+  } else if (name == "sap-l1" || name == "shortest-augmenting-path-l1") {
+    return kShortestAugmentingPathL1;
+  } else if (name == "dp" || name == "dynamic-program") {
+    return kDynamicProgram;
   } else {
     return kUnknownType;
   }
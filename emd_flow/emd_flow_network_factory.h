@@ -2,6 +2,7 @@
 #define __EMD_FLOW_NETWORK_FACTORY_H__
 
 #include "emd_flow_network.h"
+#include "emd_flow_candidates.h"
 
 #include <string>
 #include <memory>
@@ -12,13 +13,45 @@ class EMDFlowNetworkFactory {
     kLemonCostScaling,
     kLemonNetworkSimplex,
     kLemonCapacityScaling,
+    kLemonCostScalingChain,
+    kLemonNetworkSimplexChain,
+    kLemonCapacityScalingChain,
     kShortestAugmentingPath,
+    kShortestAugmentingPathBinaryHeap,
+    kShortestAugmentingPathPairingHeap,
+    kShortestAugmentingPathBlockingFlow,
+    kShortestAugmentingPathL1,
+    kDynamicProgram,
     kUnknownType
   };
 
+  // Column arcs shifting by more than max_shift rows can never carry flow in
+  // a solution with EMD at most max_shift, so the networks that build the
+  // column arcs explicitly leave them out (a negative max_shift keeps all of
+  // them). The dynamic program restricts the shifts the same way. The L1
+  // network and the LEMON networks with chains do not build these arcs and
+  // ignore max_shift.
+  // If integer_costs is set, the networks use 64-bit integer costs obtained
+  // by quantizing amplitudes and lambda (see cost_traits.h for the precision)
+  // and the SAP network uses a radix heap. The L1 network and the dynamic
+  // program (see emd_flow_network_dp.h) always use double costs. The LEMON
+  // networks always use integer costs: the LEMON algorithms require integer
+  // input data and can cycle or crash with double costs.
   static std::auto_ptr<EMDFlowNetwork> create_EMD_flow_network(
-      const std::vector<std::vector<double> >& amplitudes,
-      EMDFlowNetworkType type);
+      const EMDFlowAmplitudes& amplitudes,
+      EMDFlowNetworkType type,
+      int max_shift,
+      bool integer_costs);
+
+  // Same as above, but the SAP networks (except the L1 network) are built
+  // only on the candidate entries (see emd_flow_candidates.h). The other
+  // types ignore the candidates and build the full network.
+  static std::auto_ptr<EMDFlowNetwork> create_EMD_flow_network(
+      const EMDFlowAmplitudes& amplitudes,
+      EMDFlowNetworkType type,
+      int max_shift,
+      bool integer_costs,
+      const EMDFlowCandidates& candidates);
 
   static EMDFlowNetworkType parse_type(const std::string& name);
 };
@@ -2,17 +2,34 @@
 #define __EMD_FLOW_NETWORK_LEMON_H__
 
 #include "emd_flow_network.h"
+#include "cost_traits.h"
 
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
 #include <lemon/list_graph.h>
 #include <lemon/maps.h>
 
 template <typename MCMFAlgorithm>
 class EMDFlowNetworkLemon : public EMDFlowNetwork {
  public:
-  EMDFlowNetworkLemon(const std::vector<std::vector<double> >& amplitudes) 
-      : EMDFlowNetwork(), capacity_(g_), cost_(g_) {
+  typedef typename MCMFAlgorithm::Cost Cost;
+
+  // Only column arcs that shift by at most max_shift rows are built (all
+  // arcs if max_shift is negative).
+  // If use_chains is set, the transitions between two columns are routed
+  // through a chain of auxiliary nodes (one per row) with arcs of cost lambda
+  // between neighbouring rows instead. This represents the same L1 cost with
+  // about 4r instead of r^2 arcs per column transition. max_shift is ignored
+  // in this case.
+  // The cost type of MCMFAlgorithm is either double or long long (amplitudes
+  // and lambda are then quantized as described in cost_traits.h).
+  EMDFlowNetworkLemon(const EMDFlowAmplitudes& amplitudes,
+      int max_shift, bool use_chains)
+      : EMDFlowNetwork(), max_shift_(max_shift), use_chains_(use_chains),
+        capacity_(g_), cost_(g_) {
     construct_graph(amplitudes);
   }
 
@@ -61,6 +78,22 @@ class EMDFlowNetworkLemon : public EMDFlowNetwork {
     return r_;
   }
 
+  // The LEMON algorithms always start from scratch, so keep_flow is ignored.
+  bool update_amplitudes(const EMDFlowAmplitudes& amplitudes,
+      bool /*keep_flow*/) {
+    if (amplitudes.num_rows() != r_ || amplitudes.num_columns() != c_) {
+      return false;
+    }
+    read_amplitudes(amplitudes);
+    for (int row = 0; row < r_; ++row) {
+      for (int col = 0; col < c_; ++col) {
+        cost_[nodearcs_[row][col]] =
+            -CostTraits<Cost>::quantize(std::abs(a_[row][col]), scale_);
+      }
+    }
+    return true;
+  }
+
   ~EMDFlowNetworkLemon() {
     delete alg_;
   }
@@ -74,6 +107,12 @@ class EMDFlowNetworkLemon : public EMDFlowNetwork {
   int r_;
   // number of columns
   int c_;
+  // largest row shift between two columns with an arc (negative: no limit)
+  int max_shift_;
+  // route column transitions through chains of auxiliary nodes
+  bool use_chains_;
+  // factor applied to amplitudes and lambda before rounding them to Cost
+  double scale_;
 
   // nodes corresponding to the matrix entries
   std::vector<std::vector<lemon::ListDigraph::Node> > innode_;
@@ -82,10 +121,12 @@ class EMDFlowNetworkLemon : public EMDFlowNetwork {
   std::vector<std::vector<lemon::ListDigraph::Arc> > nodearcs_;
   // arcs corresponding to the EMD
   std::vector<std::vector<std::vector<lemon::ListDigraph::Arc> > > colarcs_;
+  // chain arcs between neighbouring rows, one chain per column transition
+  std::vector<std::vector<lemon::ListDigraph::Arc> > chainarcs_;
   // graph
   lemon::ListDigraph g_;
   lemon::ListDigraph::ArcMap<int> capacity_;
-  lemon::ListDigraph::ArcMap<double> cost_;
+  lemon::ListDigraph::ArcMap<Cost> cost_;
   // source
   lemon::ListDigraph::Node s_;
   // sink
@@ -94,24 +135,50 @@ class EMDFlowNetworkLemon : public EMDFlowNetwork {
   // algorithm
   MCMFAlgorithm* alg_;
 
+  // range of rows in the next column reachable from row r
+  int first_dest(int r) {
+    return (max_shift_ < 0 || r < max_shift_) ? 0 : r - max_shift_;
+  }
+
+  int last_dest(int r) {
+    return (max_shift_ < 0 || r + max_shift_ >= r_) ? r_ - 1 : r + max_shift_;
+  }
+
   void apply_lambda(double lambda) {
+    Cost lambda_cost = CostTraits<Cost>::quantize(lambda, scale_);
+    if (use_chains_) {
+      for (int col = 0; col < c_ - 1; ++col) {
+        for (size_t ii = 0; ii < chainarcs_[col].size(); ++ii) {
+          cost_[chainarcs_[col][ii]] = lambda_cost;
+        }
+      }
+      return;
+    }
+
     for (int row = 0; row < r_; ++row) {
       for (int col = 0; col < c_ - 1; ++col) {
-        for (int dest = 0; dest < r_; ++dest) {
-          cost_[colarcs_[row][col][dest]] = lambda * abs(row - dest);
+        for (int dest = first_dest(row); dest <= last_dest(row); ++dest) {
+          cost_[colarcs_[row][col][dest - first_dest(row)]] =
+              lambda_cost * abs(row - dest);
         }
       }
     }
   }
 
   int extract_emd_cost() {
+    if (use_chains_) {
+      return extract_emd_cost_from_support();
+    }
+
     int emd_cost = 0;
     for (int row = 0; row < r_; ++row) {
       for (int col = 0; col < c_ - 1; ++col) {
-        for (int dest = 0; dest < r_; ++dest) {
-          if (alg_->flow(colarcs_[row][col][dest]) > 0) {
+        for (int dest = first_dest(row); dest <= last_dest(row); ++dest) {
+          lemon::ListDigraph::Arc a =
+              colarcs_[row][col][dest - first_dest(row)];
+          if (alg_->flow(a) > 0) {
             emd_cost += abs(row - dest);
-            if (alg_->flow(colarcs_[row][col][dest]) != 1) {
+            if (alg_->flow(a) != 1) {
               fprintf(stderr, "ERROR: nonzero flow on a column edge is not "
                   "1.\n");
             }
@@ -122,12 +189,45 @@ class EMDFlowNetworkLemon : public EMDFlowNetwork {
     return emd_cost;
   }
 
+  // The chains do not record which row a unit of flow came from. An optimal
+  // flow moves the k entries of a column to the k entries of the next column
+  // along the sorted matching, which is an optimal 1D transport, so the EMD
+  // can be read off the support.
+  int extract_emd_cost_from_support() {
+    int emd_cost = 0;
+    std::vector<int> cur_rows;
+    std::vector<int> next_rows;
+    for (int row = 0; row < r_; ++row) {
+      if (alg_->flow(nodearcs_[row][0]) > 0) {
+        cur_rows.push_back(row);
+      }
+    }
+    for (int col = 0; col < c_ - 1; ++col) {
+      next_rows.clear();
+      for (int row = 0; row < r_; ++row) {
+        if (alg_->flow(nodearcs_[row][col + 1]) > 0) {
+          next_rows.push_back(row);
+        }
+      }
+      if (next_rows.size() != cur_rows.size()) {
+        fprintf(stderr, "ERROR: columns with different numbers of supported "
+            "entries.\n");
+      }
+      for (size_t ii = 0; ii < cur_rows.size() && ii < next_rows.size();
+          ++ii) {
+        emd_cost += abs(cur_rows[ii] - next_rows[ii]);
+      }
+      cur_rows.swap(next_rows);
+    }
+    return emd_cost;
+  }
+
   double extract_amp_sum() {
     double amp_sum = 0;
     for (int row = 0; row < r_; ++row) {
       for (int col = 0; col < c_; ++col) {
         if (alg_->flow(nodearcs_[row][col]) > 0) {
-          amp_sum += abs(a_[row][col]);
+          amp_sum += std::abs(a_[row][col]);
           if (alg_->flow(nodearcs_[row][col]) != 1) {
             fprintf(stderr, "ERROR: nonzero flow on a node edge is not 1.\n");
           }
@@ -137,19 +237,27 @@ class EMDFlowNetworkLemon : public EMDFlowNetwork {
     return amp_sum;
   }
 
-  void construct_graph(const std::vector<std::vector<double> >& amplitudes) {
-    // number of rows
-    r_ = amplitudes.size();
-    // number of columns
-    c_ = amplitudes[0].size();
-
+  // stores the amplitudes in a_ and sets scale_
+  void read_amplitudes(const EMDFlowAmplitudes& amplitudes) {
     a_.resize(r_);
+    double max_amplitude = 0.0;
     for (int row = 0; row < r_; ++row) {
       a_[row].resize(c_);
       for (int col = 0; col < c_; ++col) {
-        a_[row][col] = amplitudes[row][col];
+        a_[row][col] = amplitudes(row, col);
+        max_amplitude = std::max(max_amplitude, std::abs(a_[row][col]));
       }
     }
+    scale_ = CostTraits<Cost>::quantization_scale(max_amplitude);
+  }
+
+  void construct_graph(const EMDFlowAmplitudes& amplitudes) {
+    // number of rows
+    r_ = amplitudes.num_rows();
+    // number of columns
+    c_ = amplitudes.num_columns();
+
+    read_amplitudes(amplitudes);
 
     // source and sink
     s_ = g_.addNode();
@@ -173,7 +281,8 @@ class EMDFlowNetworkLemon : public EMDFlowNetwork {
       nodearcs_[ii].resize(c_);
       for (int jj = 0; jj < c_; ++jj) {
         nodearcs_[ii][jj] = g_.addArc(innode_[ii][jj], outnode_[ii][jj]);
-        cost_[nodearcs_[ii][jj]] = - abs(a_[ii][jj]);
+        cost_[nodearcs_[ii][jj]] =
+            -CostTraits<Cost>::quantize(std::abs(a_[ii][jj]), scale_);
         capacity_[nodearcs_[ii][jj]] = 1;
       }
     }
@@ -192,25 +301,66 @@ class EMDFlowNetworkLemon : public EMDFlowNetwork {
       capacity_[a] = 1;
     }
 
-    // add arcs between columns
+    if (use_chains_) {
+      construct_chains();
+    } else {
+      construct_column_arcs();
+    }
+
+    alg_ = new MCMFAlgorithm(g_);
+    alg_->upperMap(capacity_);
+
+    set_sparsity(0);
+  }
+
+  // add chains of auxiliary nodes between columns
+  void construct_chains() {
+    chainarcs_.resize(c_ - 1);
+    std::vector<lemon::ListDigraph::Node> chain(r_);
+    for (int col = 0; col < c_ - 1; ++col) {
+      for (int row = 0; row < r_; ++row) {
+        chain[row] = g_.addNode();
+
+        lemon::ListDigraph::Arc a = g_.addArc(outnode_[row][col], chain[row]);
+        cost_[a] = 0;
+        capacity_[a] = 1;
+
+        a = g_.addArc(chain[row], innode_[row][col + 1]);
+        cost_[a] = 0;
+        capacity_[a] = 1;
+      }
+
+      // up and down arcs between neighbouring rows
+      for (int row = 0; row < r_ - 1; ++row) {
+        lemon::ListDigraph::Arc a = g_.addArc(chain[row], chain[row + 1]);
+        cost_[a] = 1;
+        capacity_[a] = r_;
+        chainarcs_[col].push_back(a);
+
+        a = g_.addArc(chain[row + 1], chain[row]);
+        cost_[a] = 1;
+        capacity_[a] = r_;
+        chainarcs_[col].push_back(a);
+      }
+    }
+  }
+
+  // add arcs between columns
+  void construct_column_arcs() {
     colarcs_.resize(r_);
     for (int row = 0; row < r_; ++row) {
       colarcs_[row].resize(c_ - 1);
       for (int col = 0; col < c_ - 1; ++col) {
-        colarcs_[row][col].resize(r_);
-        for (int dest = 0; dest < r_; ++dest) {
-          colarcs_[row][col][dest] =
+        colarcs_[row][col].resize(last_dest(row) - first_dest(row) + 1);
+        for (int dest = first_dest(row); dest <= last_dest(row); ++dest) {
+          lemon::ListDigraph::Arc a =
             g_.addArc(outnode_[row][col], innode_[dest][col + 1]);
-          cost_[colarcs_[row][col][dest]] = abs(row - dest);
-          capacity_[colarcs_[row][col][dest]] = 1;
+          colarcs_[row][col][dest - first_dest(row)] = a;
+          cost_[a] = abs(row - dest);
+          capacity_[a] = 1;
         }
       }
     }
-
-    alg_ = new MCMFAlgorithm(g_);
-    alg_->upperMap(capacity_);
-
-    set_sparsity(0);
   }
 
 };
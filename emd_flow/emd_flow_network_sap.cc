@@ -1,206 +1,338 @@
 #include "emd_flow_network_sap.h"
+#include "distance_transform.h"
 
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
 #include <algorithm>
 #include <limits>
-#include <queue>
-#include <map>
+#include <utility>
 
 using namespace std;
 
-EMDFlowNetworkSAP::EMDFlowNetworkSAP(
-    const std::vector<std::vector<double> >& amplitudes) : a_(amplitudes),
+template <typename PriorityQueue>
+EMDFlowNetworkSAP<PriorityQueue>::EMDFlowNetworkSAP(
+    const EMDFlowAmplitudes& amplitudes, int max_shift)
+    : EMDFlowNetworkSAP(amplitudes, max_shift, EMDFlowCandidates()) { }
+
+template <typename PriorityQueue>
+EMDFlowNetworkSAP<PriorityQueue>::EMDFlowNetworkSAP(
+    const EMDFlowAmplitudes& amplitudes, int max_shift,
+    const EMDFlowCandidates& candidates)
+    : max_shift_(max_shift), candidates_(candidates), pruned_(false),
+    epoch_(0), warm_start_(true), blocking_flow_(false), flow_value_(0),
     total_inner_iterations(0), checking_inner_iterations(0),
-    updating_inner_iterations(0) {
-  r_ = amplitudes.size();
-  c_ = amplitudes[0].size();
+    updating_inner_iterations(0), num_cold_starts(0), num_warm_starts(0),
+    num_cancelled_cycles(0), num_dijkstra_runs(0), num_settled_nodes(0),
+    num_augmenting_paths(0), num_graph_builds(0), num_candidate_checks(0),
+    num_potential_repairs(0), num_added_candidates(0) {
+  r_ = amplitudes.num_rows();
+  c_ = amplitudes.num_columns();
 
-  a_.resize(r_);
-  for (int row = 0; row < r_; ++row) {
-    a_[row].resize(c_);
-    for (int col = 0; col < c_; ++col) {
-      a_[row][col] = amplitudes[row][col];
-    }
-  }
+  read_amplitudes(amplitudes);
 
   // source and sink
   s_ = 0;
-  t_ = 1;
+  t_ = 1 + 2 * r_ * c_;
 
-  // potentials
+  // The node indices do not depend on the candidates, the nodes of pruned
+  // entries simply have no edges.
   int num_nodes = 2 + 2 * r_ * c_;
-  outgoing_edges_.resize(num_nodes);
-  potential_.resize(outgoing_edges_.size());
+  potential_.resize(num_nodes);
+  queue_.resize(num_nodes);
+  dst_.resize(num_nodes);
+  parent_edge_.resize(num_nodes);
+  seen_epoch_.resize(num_nodes, 0);
+  done_epoch_.resize(num_nodes, 0);
+  current_edge_.resize(num_nodes);
+  on_path_.resize(num_nodes, 0);
+
+  for (size_t row = 0; row < candidates_.mask.size(); ++row) {
+    for (int col = 0; col < c_; ++col) {
+      if (!candidates_.mask[row][col]) {
+        pruned_ = true;
+      }
+    }
+  }
+  if (!pruned_) {
+    candidates_.mask.clear();
+  }
+
+  build_graph();
+
+  set_sparsity(0);
+}
+
+// Builds the graph on the candidate entries. The flow is reset.
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::build_graph() {
+  Topology* topology = new Topology;
+  topology_.reset(topology);
+  edge_cost_.clear();
+  edge_capacity_.clear();
+
+  // start node of every edge, only needed until the CSR arrays are built
+  vector<NodeIndex> edge_from;
 
   // add arcs from source to column 1
   for (int ii = 0; ii < r_; ++ii) {
-    EdgeIndex next_edge_index = e_.size();
-    Edge forward(innode_index(ii, 0), 1, 0.0, next_edge_index + 1);
-    Edge backward(s_, 0, 0.0, next_edge_index);
-    e_.push_back(forward);
-    e_.push_back(backward);
-    outgoing_edges_[s_].push_back(next_edge_index);
-    outgoing_edges_[innode_index(ii, 0)].push_back(next_edge_index + 1);
+    if (is_candidate(ii, 0)) {
+      add_edge_pair(s_, innode_index(ii, 0), 0, &edge_from, topology);
+    }
   }
 
   // add arcs from column c to sink
   for (int ii = 0; ii < r_; ++ii) {
-    EdgeIndex next_edge_index = e_.size();
-    Edge forward(t_, 1, 0.0, next_edge_index + 1);
-    Edge backward(outnode_index(ii, c_ - 1), 0, 0.0, next_edge_index);
-    e_.push_back(forward);
-    e_.push_back(backward);
-    outgoing_edges_[outnode_index(ii, c_ - 1)].push_back(next_edge_index);
-    outgoing_edges_[t_].push_back(next_edge_index + 1);
+    if (is_candidate(ii, c_ - 1)) {
+      add_edge_pair(outnode_index(ii, c_ - 1), t_, 0, &edge_from, topology);
+    }
   }
 
   // add arcs from innodes to outnodes
-  node_edges_.resize(r_);
+  topology->node_edges.assign(r_ * c_, no_edge());
   for (int ii = 0; ii < r_; ++ii) {
-    node_edges_[ii].resize(c_);
     for (int jj = 0; jj < c_; ++jj) {
-      EdgeIndex next_edge_index = e_.size();
-      Edge forward(outnode_index(ii, jj), 1, -abs(a_[ii][jj]),
-          next_edge_index + 1);
-      Edge backward(innode_index(ii, jj), 0, abs(a_[ii][jj]),
-          next_edge_index);
-      e_.push_back(forward);
-      e_.push_back(backward);
-      node_edges_[ii][jj] = next_edge_index;
-      outgoing_edges_[innode_index(ii, jj)].push_back(next_edge_index);
-      outgoing_edges_[outnode_index(ii, jj)].push_back(next_edge_index + 1);
+      if (is_candidate(ii, jj)) {
+        topology->node_edges[entry_index(ii, jj)] = add_edge_pair(
+            innode_index(ii, jj), outnode_index(ii, jj),
+            -CostTraits<Cost>::quantize(a_[entry_index(ii, jj)], scale_),
+            &edge_from, topology);
+      }
+    }
+  }
+
+  // add arcs between columns (only the candidate rows of the next column
+  // are visited, so a pruned graph is built in time proportional to its
+  // size)
+  topology->emd_edges.assign(r_ * c_, no_edge());
+  vector<int> next_rows;
+  for (int col = 0; col < c_ - 1; ++col) {
+    next_rows.clear();
+    for (int dest = 0; dest < r_; ++dest) {
+      if (is_candidate(dest, col + 1)) {
+        next_rows.push_back(dest);
+      }
+    }
+    size_t first = 0;
+    for (int row = 0; row < r_; ++row) {
+      if (!is_candidate(row, col)) {
+        continue;
+      }
+      while (first < next_rows.size() && next_rows[first] < first_dest(row)) {
+        ++first;
+      }
+      for (size_t ii = first; ii < next_rows.size()
+          && next_rows[ii] <= last_dest(row); ++ii) {
+        EdgeIndex cur = add_edge_pair(outnode_index(row, col),
+            innode_index(next_rows[ii], col + 1), 0, &edge_from, topology);
+        if (ii == first) {
+          topology->emd_edges[entry_index(row, col)] = cur;
+        }
+      }
+    }
+  }
+
+  build_csr(edge_from, topology);
+
+  first_out_ = &(topology->first_out[0]);
+  edge_to_ = &(topology->edge_to[0]);
+  edge_opposite_ = &(topology->edge_opposite[0]);
+  node_edges_ = &(topology->node_edges[0]);
+  emd_edges_ = &(topology->emd_edges[0]);
+  num_edges_ = topology->edge_to.size();
+
+  flow_value_ = 0;
+  ++num_graph_builds;
+}
+
+// Stores the absolute values of the amplitudes in a_ and sets scale_.
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::read_amplitudes(
+    const EMDFlowAmplitudes& amplitudes) {
+  a_.resize(r_ * c_);
+  double max_amplitude = 0.0;
+  for (int row = 0; row < r_; ++row) {
+    for (int col = 0; col < c_; ++col) {
+      a_[entry_index(row, col)] = abs(amplitudes(row, col));
+      max_amplitude = max(max_amplitude, a_[entry_index(row, col)]);
     }
   }
+  scale_ = CostTraits<Cost>::quantization_scale(max_amplitude);
+}
 
-  // add arcs between columns
-  emd_edges_.resize(r_);
+// Appends an edge with capacity 1 and its reverse edge with capacity 0.
+// Returns the index of the forward edge.
+template <typename PriorityQueue>
+typename EMDFlowNetworkSAP<PriorityQueue>::EdgeIndex
+EMDFlowNetworkSAP<PriorityQueue>::add_edge_pair(NodeIndex from, NodeIndex to,
+    Cost cost, vector<NodeIndex>* edge_from, Topology* topology) {
+  EdgeIndex next_edge_index = topology->edge_to.size();
+
+  edge_from->push_back(from);
+  topology->edge_to.push_back(to);
+  edge_cost_.push_back(cost);
+  edge_capacity_.push_back(1);
+  topology->edge_opposite.push_back(next_edge_index + 1);
+
+  edge_from->push_back(to);
+  topology->edge_to.push_back(from);
+  edge_cost_.push_back(-cost);
+  edge_capacity_.push_back(0);
+  topology->edge_opposite.push_back(next_edge_index);
+
+  return next_edge_index;
+}
+
+// Sorts the edges by start node (stable, so the EMD edges leaving an outnode
+// stay contiguous) and fills topology->first_out. All stored edge indices are
+// translated to the new order.
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::build_csr(
+    const vector<NodeIndex>& edge_from, Topology* topology) {
+  size_t num_nodes = potential_.size();
+  size_t num_edges = topology->edge_to.size();
+
+  topology->first_out.assign(num_nodes + 1, 0);
+  for (size_t ii = 0; ii < num_edges; ++ii) {
+    ++topology->first_out[edge_from[ii] + 1];
+  }
+  for (size_t ii = 0; ii < num_nodes; ++ii) {
+    topology->first_out[ii + 1] += topology->first_out[ii];
+  }
+
+  vector<EdgeIndex> next_position(topology->first_out.begin(),
+      topology->first_out.end() - 1);
+  vector<EdgeIndex> position(num_edges);
+  for (size_t ii = 0; ii < num_edges; ++ii) {
+    position[ii] = next_position[edge_from[ii]]++;
+  }
+
+  vector<NodeIndex> to(num_edges);
+  vector<Cost> cost(num_edges);
+  vector<int> capacity(num_edges);
+  vector<EdgeIndex> opposite(num_edges);
+  for (size_t ii = 0; ii < num_edges; ++ii) {
+    to[position[ii]] = topology->edge_to[ii];
+    cost[position[ii]] = edge_cost_[ii];
+    capacity[position[ii]] = edge_capacity_[ii];
+    opposite[position[ii]] = position[topology->edge_opposite[ii]];
+  }
+  topology->edge_to.swap(to);
+  edge_cost_.swap(cost);
+  edge_capacity_.swap(capacity);
+  topology->edge_opposite.swap(opposite);
+
+  for (size_t ii = 0; ii < topology->node_edges.size(); ++ii) {
+    if (topology->node_edges[ii] != no_edge()) {
+      topology->node_edges[ii] = position[topology->node_edges[ii]];
+    }
+  }
+  // entries without EMD edges get an empty range
   for (int row = 0; row < r_; ++row) {
-    emd_edges_[row].resize(c_ - 1);
     for (int col = 0; col < c_ - 1; ++col) {
-      emd_edges_[row][col].resize(r_);
-      for (int dest = 0; dest < r_; ++dest) {
-        EdgeIndex next_edge_index = e_.size();
-        Edge forward(innode_index(dest, col + 1), 1, 0.0, next_edge_index + 1);
-        Edge backward(outnode_index(row, col), 0, 0.0, next_edge_index);
-        e_.push_back(forward);
-        e_.push_back(backward);
-        emd_edges_[row][col][dest] = next_edge_index;
-        outgoing_edges_[outnode_index(row, col)].push_back(next_edge_index);
-        outgoing_edges_[innode_index(dest, col + 1)].push_back(
-            next_edge_index + 1);
+      size_t entry = entry_index(row, col);
+      if (topology->emd_edges[entry] != no_edge()) {
+        topology->emd_edges[entry] = position[topology->emd_edges[entry]];
+      } else {
+        topology->emd_edges[entry] =
+            topology->first_out[outnode_index(row, col) + 1];
       }
     }
   }
-
-  set_sparsity(0);
 }
 
-void EMDFlowNetworkSAP::print_full_graph() {
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::print_full_graph() {
   printf("Node indices:\n");
-  printf("  Source: %lu, sink: %lu\n", s_, t_);
+  printf("  Source: %u, sink: %u\n", s_, t_);
   for (int col = 0; col < c_; ++col) {
     for (int row = 0; row < r_; ++row) {
-      printf("  Entry %d,%d: innode: %lu, outnode: %lu\n", row, col,
+      printf("  Entry %d,%d: innode: %u, outnode: %u\n", row, col,
           innode_index(row, col), outnode_index(row, col));
     }
   }
 
   printf("Edges:\n");
-  for (size_t ii = 0; ii < outgoing_edges_.size(); ++ii) {
-    for (size_t jj = 0; jj < outgoing_edges_[ii].size(); ++jj) {
-      EdgeIndex curi = outgoing_edges_[ii][jj];
-      Edge cur = e_[curi];
-      printf("  Edge %lu: from: %lu, to: %lu, cap: %d, cost: %f, "
-          "opposite: %lu\n", curi, ii, cur.to, cur.capacity, cur.cost,
-          cur.opposite);
+  for (NodeIndex from = 0; from < potential_.size(); ++from) {
+    for (EdgeIndex e = first_out_[from]; e < first_out_[from + 1]; ++e) {
+      printf("  Edge %u: from: %u, to: %u, cap: %d, cost: %f, "
+          "opposite: %u\n", e, from, edge_to_[e], edge_capacity_[e],
+          static_cast<double>(edge_cost_[e]), edge_opposite_[e]);
     }
   }
 
   printf("Potentials:\n");
   for (size_t ii = 0; ii < potential_.size(); ++ii) {
-    printf("  Node %lu: potential %f\n", ii, potential_[ii]);
+    printf("  Node %lu: potential %f\n", ii,
+        static_cast<double>(potential_[ii]));
   }
 }
 
-void EMDFlowNetworkSAP::apply_lambda(double lambda) {
-  for (int row = 0; row < r_; ++row) {
-    for (int col = 0; col < c_ - 1; ++col) {
-      for (int dest = 0; dest < r_; ++dest) {
-        EdgeIndex cur = emd_edges_[row][col][dest];
-        e_[cur].cost = lambda * abs(row - dest);
-        e_[e_[cur].opposite].cost = -lambda * abs(row - dest);
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::apply_lambda(double lambda) {
+  Cost lambda_cost = CostTraits<Cost>::quantize(lambda, scale_);
+  for (int col = 0; col < c_ - 1; ++col) {
+    NodeIndex first_innode = innode_index(0, col + 1);
+    for (int row = 0; row < r_; ++row) {
+      EdgeIndex end = first_out_[outnode_index(row, col) + 1];
+      for (EdgeIndex e = emd_edges_[entry_index(row, col)]; e < end; ++e) {
+        int dest = (edge_to_[e] - first_innode) / 2;
+        edge_cost_[e] = lambda_cost * abs(row - dest);
+        edge_cost_[edge_opposite_[e]] = -lambda_cost * abs(row - dest);
       }
     }
   }
 }
 
-void EMDFlowNetworkSAP::reset_flow() {
-  // edges from source to column 1
-  for (size_t ii = 0; ii < outgoing_edges_[s_].size(); ++ii) {
-    EdgeIndex cur = outgoing_edges_[s_][ii];
-    e_[cur].capacity = 1;
-    e_[e_[cur].opposite].capacity = 0;
-  }
-
-  // edges from column c to sink
-  for (size_t ii = 0; ii < outgoing_edges_[t_].size(); ++ii) {
-    EdgeIndex cur = outgoing_edges_[t_][ii];
-    e_[cur].capacity = 0;
-    e_[e_[cur].opposite].capacity = 1;
-  }
-
-  // edges from innodes to outnodes
-  for (int ii = 0; ii < r_; ++ii) {
-    for (int jj = 0; jj < c_; ++jj) {
-      EdgeIndex cur = node_edges_[ii][jj];
-      e_[cur].capacity = 1;
-      e_[e_[cur].opposite].capacity = 0;
-    }
-  }
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::reset_flow() {
+  flow_value_ = 0;
 
-  // edges between columns
-  for (int row = 0; row < r_; ++row) {
-    for (int col = 0; col < c_ - 1; ++col) {
-      for (int dest = 0; dest < r_; ++dest) {
-        EdgeIndex cur = emd_edges_[row][col][dest];
-        e_[cur].capacity = 1;
-        e_[e_[cur].opposite].capacity = 0;
-      }
+  // The node indices are a topological order of the network without flow,
+  // so the forward edges are exactly the edges to a larger node index.
+  for (NodeIndex from = 0; from < potential_.size(); ++from) {
+    for (EdgeIndex e = first_out_[from]; e < first_out_[from + 1]; ++e) {
+      edge_capacity_[e] = (from < edge_to_[e]) ? 1 : 0;
     }
   }
 }
 
-void EMDFlowNetworkSAP::compute_initial_potential() {
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::compute_initial_potential() {
   // initialize potentials (= distances) to largest possible value
   for (size_t ii = 0; ii < potential_.size(); ++ii) {
-    potential_[ii] = numeric_limits<double>::infinity();
+    potential_[ii] = CostTraits<Cost>::infinity();
   }
 
   // source and first column have potential 0
-  potential_[s_] = 0.0;
+  potential_[s_] = 0;
   for (int ii = 0; ii < r_; ++ii) {
-    potential_[innode_index(ii, 0)] = 0.0;
-    potential_[outnode_index(ii, 0)] = -abs(a_[ii][0]);
+    if (in_graph(entry_index(ii, 0))) {
+      potential_[innode_index(ii, 0)] = 0;
+      potential_[outnode_index(ii, 0)] =
+          edge_cost_[node_edges_[entry_index(ii, 0)]];
+    }
   }
 
   // iteratively update next layer based on current layer
   for (int col = 0; col < c_ - 1; ++col) {
-    // across column
+    // across column (the outnodes of pruned entries have no edges)
     for (int row = 0; row < r_; ++row) {
       NodeIndex from = outnode_index(row, col);
-      double cur_potential = potential_[from];
-      for (size_t ii = 0; ii < outgoing_edges_[from].size(); ++ii) {
-        NodeIndex to = e_[outgoing_edges_[from][ii]].to;
-        double edge_cost = e_[outgoing_edges_[from][ii]].cost;
-        potential_[to] = min(potential_[to], cur_potential + edge_cost);
+      Cost cur_potential = potential_[from];
+      for (EdgeIndex e = first_out_[from]; e < first_out_[from + 1]; ++e) {
+        NodeIndex to = edge_to_[e];
+        potential_[to] = min(potential_[to], cur_potential + edge_cost_[e]);
       }
     }
 
     // innode to outnode
     for (int row = 0; row < r_; ++row) {
-      potential_[outnode_index(row, col + 1)] =
-          potential_[innode_index(row, col + 1)] - abs(a_[row][col + 1]);
+      if (in_graph(entry_index(row, col + 1))) {
+        potential_[outnode_index(row, col + 1)] =
+            potential_[innode_index(row, col + 1)]
+            + edge_cost_[node_edges_[entry_index(row, col + 1)]];
+      }
     }
   }
 
@@ -208,100 +340,663 @@ void EMDFlowNetworkSAP::compute_initial_potential() {
   for (int ii = 0; ii < r_; ++ii) {
     potential_[t_] = min(potential_[t_], potential_[outnode_index(ii, c_ - 1)]);
   }
-}
 
-void EMDFlowNetworkSAP::set_sparsity(int k) {
-  k_ = k;
+  // The nodes of pruned entries are never touched, but a warm start needs
+  // finite potentials everywhere.
+  if (pruned_) {
+    for (size_t entry = 0; entry < a_.size(); ++entry) {
+      if (!in_graph(entry)) {
+        potential_[1 + 2 * entry] = 0;
+        potential_[2 + 2 * entry] = 0;
+      }
+    }
+  }
 }
 
-void EMDFlowNetworkSAP::run_flow(double lambda) {
-  typedef pair<double, EMDFlowNetworkSAP::NodeIndex> q_elem;
+// Re-optimizes the current flow after a change of the edge costs (e.g., a new
+// lambda). Starting from the previous potentials, a label-correcting pass
+// repairs every residual edge whose reduced cost became negative. If the
+// repair runs into a negative cycle, the previous flow is no longer optimal
+// and the cycle is cancelled, so only the parts of the flow that became
+// non-optimal get re-routed. Returns false if the repair becomes more
+// expensive than computing the flow from scratch (or the potentials cannot be
+// reused), in which case the caller has to reset the flow.
+template <typename PriorityQueue>
+bool EMDFlowNetworkSAP<PriorityQueue>::reoptimize_flow() {
+  const EdgeIndex kNoEdge = numeric_limits<EdgeIndex>::max();
+  size_t num_nodes = potential_.size();
 
-  reset_flow();
-  apply_lambda(lambda);
-  compute_initial_potential();
+  Cost max_potential = 0;
+  for (size_t ii = 0; ii < num_nodes; ++ii) {
+    if (!(abs(potential_[ii]) < CostTraits<Cost>::infinity())) {
+      return false;
+    }
+    max_potential = max(max_potential, abs(potential_[ii]));
+  }
+  Cost tolerance = CostTraits<Cost>::tolerance(max_potential);
 
-  vector<EdgeIndex> edge_taken_to(potential_.size(), 0);
-  vector<bool> visited(potential_.size(), false);
-  vector<double> dst(potential_.size(), numeric_limits<double>::infinity());
+  // Nodes waiting to be scanned are kept in one bucket per column and the
+  // leftmost column is scanned first. Most residual edges point to the next
+  // column, so this is close to a topological order.
+  vector<vector<NodeIndex> > buckets(c_ + 2);
+  size_t cur_bucket = buckets.size();
+  size_t num_queued = 0;
 
-  // find a new flow
-  for (int total_flow = 0; total_flow < min(k_, r_); ++total_flow) {
-    // Dijkstra
-    fill(visited.begin(), visited.end(), false);
-    fill(dst.begin(), dst.end(), numeric_limits<double>::infinity());
-    priority_queue<q_elem> q;
+  // start with all nodes that have a violating outgoing edge
+  vector<EdgeIndex> parent(num_nodes, kNoEdge);
+  vector<bool> in_queue(num_nodes, false);
+  for (NodeIndex from = 0; from < num_nodes; ++from) {
+    for (EdgeIndex e = first_out_[from]; e < first_out_[from + 1]; ++e) {
+      if (edge_capacity_[e] > 0 && edge_cost_[e] + potential_[from]
+          - potential_[edge_to_[e]] < -tolerance) {
+        size_t bucket = bucket_index(from);
+        buckets[bucket].push_back(from);
+        cur_bucket = min(cur_bucket, bucket);
+        ++num_queued;
+        in_queue[from] = true;
+        break;
+      }
+    }
+  }
 
-    dst[s_] = 0.0;
-    q.push(q_elem(-dst[s_], s_));
+  // a full run augments flow_value_ paths, each scanning all edges
+  long long max_scanned_edges = static_cast<long long>(flow_value_)
+      * num_edges_;
+  long long scanned_edges = 0;
+  size_t relabels_since_check = 0;
+  vector<size_t> walk(num_nodes);
 
-    size_t num_found = 0;
+  while (num_queued > 0) {
+    while (buckets[cur_bucket].empty()) {
+      ++cur_bucket;
+    }
+    NodeIndex cur_node = buckets[cur_bucket].back();
+    buckets[cur_bucket].pop_back();
+    --num_queued;
+    in_queue[cur_node] = false;
 
-    while (!q.empty() && num_found < potential_.size()) {
-      q_elem top = q.top();
-      q.pop();
+    for (EdgeIndex e = first_out_[cur_node]; e < first_out_[cur_node + 1];
+        ++e) {
+      if (EMD_FLOW_STATS) {
+        ++total_inner_iterations;
+      }
 
-      if (visited[top.second]) {
+      if (edge_capacity_[e] == 0) {
         continue;
       }
 
-      NodeIndex cur_node = top.second;
-      visited[cur_node] = true;
-      ++num_found;
-
-      NodeIndex next_node;
-      for (vector<EdgeIndex>::iterator iter = outgoing_edges_[cur_node].begin();
-          iter != outgoing_edges_[cur_node].end(); ++iter) {
-        const Edge& e = e_[*iter];
-        next_node = e.to;
+      if (EMD_FLOW_STATS) {
+        ++checking_inner_iterations;
+      }
 
-        ++total_inner_iterations;
+      NodeIndex to = edge_to_[e];
+      Cost new_potential = potential_[cur_node] + edge_cost_[e];
+      if (new_potential < potential_[to] - tolerance) {
+        potential_[to] = new_potential;
+        parent[to] = e;
+        if (!in_queue[to]) {
+          size_t bucket = bucket_index(to);
+          buckets[bucket].push_back(to);
+          cur_bucket = min(cur_bucket, bucket);
+          ++num_queued;
+          in_queue[to] = true;
+        }
+        ++relabels_since_check;
 
-        if (e.capacity == 0) {
-          continue;
+        if (EMD_FLOW_STATS) {
+          ++updating_inner_iterations;
         }
-        if (visited[next_node]) {
-          continue;
+      }
+    }
+
+    scanned_edges += first_out_[cur_node + 1] - first_out_[cur_node];
+    if (scanned_edges > max_scanned_edges) {
+      return false;
+    }
+
+    // Labels that keep decreasing indicate a negative cycle, which then also
+    // shows up as a cycle in the parent pointers. Checking the parent pointers
+    // takes linear time, so it is only done every few relabels.
+    if (relabels_since_check < num_nodes / 8) {
+      continue;
+    }
+    relabels_since_check = 0;
+    fill(walk.begin(), walk.end(), 0);
+    for (NodeIndex start = 0; start < num_nodes; ++start) {
+      NodeIndex cur = start;
+      while (walk[cur] == 0 && parent[cur] != kNoEdge) {
+        walk[cur] = start + 1;
+        cur = edge_from(parent[cur]);
+      }
+      if (walk[cur] != start + 1) {
+        continue;
+      }
+
+      // cur lies on a cycle of parent edges
+      Cost cycle_cost = 0;
+      NodeIndex node = cur;
+      do {
+        cycle_cost += edge_cost_[parent[node]];
+        node = edge_from(parent[node]);
+      } while (node != cur);
+
+      node = cur;
+      do {
+        EdgeIndex forward_edge = parent[node];
+        parent[node] = kNoEdge;
+        if (cycle_cost < -tolerance) {
+          edge_capacity_[forward_edge] -= 1;
+          edge_capacity_[edge_opposite_[forward_edge]] += 1;
         }
-        
+        node = edge_from(forward_edge);
+      } while (node != cur);
+
+      if (cycle_cost < -tolerance) {
+        ++num_cancelled_cycles;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Dijkstra with reduced costs from the source. The search stops as soon as
+// the sink is settled, so only the explored part of the graph is touched:
+// dst_ and parent_edge_ are valid only for nodes whose epoch matches.
+// Returns false if the sink cannot be reached.
+template <typename PriorityQueue>
+bool EMDFlowNetworkSAP<PriorityQueue>::find_shortest_path() {
+  // the networks live across many solves, so the epoch can wrap around
+  if (epoch_ == numeric_limits<int>::max()) {
+    fill(seen_epoch_.begin(), seen_epoch_.end(), 0);
+    fill(done_epoch_.begin(), done_epoch_.end(), 0);
+    epoch_ = 0;
+  }
+  ++epoch_;
+  ++num_dijkstra_runs;
+  settled_.clear();
+  queue_.clear();
+
+  seen_epoch_[s_] = epoch_;
+  dst_[s_] = 0;
+  queue_.push(s_, dst_[s_]);
+
+  while (!queue_.empty()) {
+    NodeIndex cur_node;
+    Cost cur_dst;
+    queue_.pop(&cur_node, &cur_dst);
+
+    // only the lazy heaps return nodes more than once
+    if (done_epoch_[cur_node] == epoch_) {
+      continue;
+    }
+    done_epoch_[cur_node] = epoch_;
+    settled_.push_back(cur_node);
+
+    if (cur_node == t_) {
+      break;
+    }
+
+    NodeIndex next_node;
+    EdgeIndex end = first_out_[cur_node + 1];
+    for (EdgeIndex e = first_out_[cur_node]; e < end; ++e) {
+      next_node = edge_to_[e];
+
+      if (EMD_FLOW_STATS) {
+        ++total_inner_iterations;
+      }
+
+      if (edge_capacity_[e] == 0) {
+        continue;
+      }
+      if (done_epoch_[next_node] == epoch_) {
+        continue;
+      }
+
+      if (EMD_FLOW_STATS) {
         ++checking_inner_iterations;
+      }
 
-        double adjusted_edge_cost = e.cost + potential_[cur_node]
-            - potential_[next_node];
-        if (dst[cur_node] + adjusted_edge_cost < dst[next_node]) {
-          dst[next_node] = dst[cur_node] + adjusted_edge_cost;
-          q.push(q_elem(-dst[next_node], next_node));
-          edge_taken_to[next_node] = *iter;
+      Cost new_dst = dst_[cur_node] + edge_cost_[e] + potential_[cur_node]
+          - potential_[next_node];
+      if (seen_epoch_[next_node] != epoch_ || new_dst < dst_[next_node]) {
+        seen_epoch_[next_node] = epoch_;
+        dst_[next_node] = new_dst;
+        queue_.push(next_node, new_dst);
+        parent_edge_[next_node] = e;
 
+        if (EMD_FLOW_STATS) {
           ++updating_inner_iterations;
         }
       }
     }
+  }
+  num_settled_nodes += settled_.size();
+
+  if (done_epoch_[t_] != epoch_) {
+    return false;
+  }
+
+  // Only the settled nodes get new potentials. This is the same as capping
+  // all distances at the distance of the sink (and shifting them by it),
+  // which keeps all reduced costs non-negative.
+  Cost sink_dst = dst_[t_];
+  for (size_t ii = 0; ii < settled_.size(); ++ii) {
+    potential_[settled_[ii]] += dst_[settled_[ii]] - sink_dst;
+  }
+  return true;
+}
+
+// Augments unit paths consisting of residual edges with reduced cost 0 (up
+// to rounding) until the flow value reaches target_flow or no such path is
+// left. These paths are shortest paths, and all edges they reverse have
+// reduced cost 0, so the potentials stay valid. The search is a DFS with
+// current-edge pointers: a node whose edges are exhausted is dead for the
+// rest of the phase. Edges back onto the current path are skipped, which
+// only makes the flow possibly non-blocking. Returns the number of paths.
+template <typename PriorityQueue>
+int EMDFlowNetworkSAP<PriorityQueue>::augment_blocking_flow(int target_flow) {
+  size_t num_nodes = potential_.size();
+
+  Cost max_potential = 0;
+  for (size_t ii = 0; ii < num_nodes; ++ii) {
+    current_edge_[ii] = first_out_[ii];
+    if (abs(potential_[ii]) < CostTraits<Cost>::infinity()) {
+      max_potential = max(max_potential, abs(potential_[ii]));
+    }
+  }
+  Cost tolerance = CostTraits<Cost>::tolerance(max_potential);
+
+  int num_paths = 0;
+  path_.clear();
+  NodeIndex cur_node = s_;
+  on_path_[s_] = 1;
+  while (flow_value_ < target_flow) {
+    if (cur_node == t_) {
+      for (size_t ii = 0; ii < path_.size(); ++ii) {
+        edge_capacity_[path_[ii]] -= 1;
+        edge_capacity_[edge_opposite_[path_[ii]]] += 1;
+        on_path_[edge_from(path_[ii])] = 0;
+      }
+      on_path_[t_] = 0;
+      path_.clear();
+      ++flow_value_;
+      ++num_paths;
+      ++num_augmenting_paths;
+      cur_node = s_;
+      on_path_[s_] = 1;
+      continue;
+    }
+
+    // advance along the first admissible edge
+    EdgeIndex end = first_out_[cur_node + 1];
+    EdgeIndex& e = current_edge_[cur_node];
+    for (; e < end; ++e) {
+      if (EMD_FLOW_STATS) {
+        ++total_inner_iterations;
+      }
+      NodeIndex next_node = edge_to_[e];
+      if (edge_capacity_[e] == 0 || on_path_[next_node]
+          || current_edge_[next_node] == first_out_[next_node + 1]) {
+        continue;
+      }
+      Cost reduced_cost = edge_cost_[e] + potential_[cur_node]
+          - potential_[next_node];
+      if (reduced_cost <= tolerance && reduced_cost >= -tolerance) {
+        break;
+      }
+    }
+
+    if (e < end) {
+      path_.push_back(e);
+      cur_node = edge_to_[e];
+      on_path_[cur_node] = 1;
+    } else {
+      // dead end: retreat
+      on_path_[cur_node] = 0;
+      if (cur_node == s_) {
+        break;
+      }
+      EdgeIndex last = path_.back();
+      path_.pop_back();
+      cur_node = edge_from(last);
+      ++current_edge_[cur_node];
+    }
+  }
+
+  for (size_t ii = 0; ii < path_.size(); ++ii) {
+    on_path_[edge_from(path_[ii])] = 0;
+  }
+  on_path_[s_] = 0;
+  path_.clear();
+  return num_paths;
+}
+
+// Only the costs of the node edges change. The EMD edge costs are set again
+// by the next run_flow (also in integer mode, where scale_ can change).
+// If the flow is kept, the next run_flow re-optimizes it like after a change
+// of lambda (see reoptimize_flow): the flow is still feasible, and usually
+// only a few of its paths are affected by small amplitude changes.
+// Verified candidates stay valid (run_flow adds the entries that become
+// necessary), heuristic candidates would have to be selected again.
+template <typename PriorityQueue>
+bool EMDFlowNetworkSAP<PriorityQueue>::update_amplitudes(
+    const EMDFlowAmplitudes& amplitudes, bool keep_flow) {
+  if (amplitudes.num_rows() != r_
+      || amplitudes.num_columns() != c_
+      || (pruned_ && !candidates_.verify)) {
+    return false;
+  }
+
+  double old_scale = scale_;
+  read_amplitudes(amplitudes);
+  for (int row = 0; row < r_; ++row) {
+    for (int col = 0; col < c_; ++col) {
+      size_t entry = entry_index(row, col);
+      if (!in_graph(entry)) {
+        continue;
+      }
+      Cost cost = -CostTraits<Cost>::quantize(a_[entry], scale_);
+      edge_cost_[node_edges_[entry]] = cost;
+      edge_cost_[edge_opposite_[node_edges_[entry]]] = -cost;
+    }
+  }
 
-    // change potentials
+  if (!keep_flow || !warm_start_) {
+    flow_value_ = 0;
+  } else if (scale_ != old_scale) {
+    // bring the potentials to the new cost scale
     for (size_t ii = 0; ii < potential_.size(); ++ii) {
-      potential_[ii] += dst[ii];
+      potential_[ii] = CostTraits<Cost>::quantize(
+          static_cast<double>(potential_[ii]) / old_scale, scale_);
+    }
+  }
+  return true;
+}
+
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::set_sparsity(int k) {
+  k_ = k;
+}
+
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::set_warm_start(bool warm_start) {
+  warm_start_ = warm_start;
+}
+
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::set_blocking_flow(bool blocking_flow) {
+  blocking_flow_ = blocking_flow;
+}
+
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::run_flow(double lambda) {
+  apply_lambda(lambda);
+  compute_flow();
+  if (!pruned_ || !candidates_.verify) {
+    return;
+  }
+
+  // A violated edge often only means that the potentials in the graph are
+  // not tight (Dijkstra does not update the nodes behind the sink). So the
+  // violated innodes first get the potential the pruned edges allow, and
+  // reoptimize_flow repairs the reduced costs in the graph. Potentials that
+  // keep decreasing indicate a negative cycle through pruned entries, i.e.,
+  // a better flow, and then the violating entries are added and the flow is
+  // computed again. Every such round adds at least one entry.
+  const int kMaxPotentialRepairs = 8;
+  int num_repairs = 0;
+  while (true) {
+    bool repair = (num_repairs < kMaxPotentialRepairs);
+    if (check_candidates(lambda, !repair) == 0) {
+      break;
+    }
+    if (repair) {
+      ++num_repairs;
+      ++num_potential_repairs;
+      if (!reoptimize_flow()) {
+        // the potentials are no longer valid
+        flow_value_ = 0;
+        compute_flow();
+        num_repairs = kMaxPotentialRepairs;
+      }
+      continue;
+    }
+
+    build_graph();
+    apply_lambda(lambda);
+    compute_flow();
+    num_repairs = 0;
+  }
+
+  //print_full_graph();
+}
+
+// Computes the optimal flow for the current edge costs.
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::compute_flow() {
+  // keep the flow of the previous run if it has the right value
+  if (warm_start_ && flow_value_ > 0 && flow_value_ == min(k_, r_)) {
+    if (reoptimize_flow()) {
+      ++num_warm_starts;
+      return;
+    }
+  }
+  ++num_cold_starts;
+
+  reset_flow();
+  compute_initial_potential();
+
+  // find a new flow
+  int target_flow = min(k_, r_);
+  while (flow_value_ < target_flow) {
+    if (!find_shortest_path()) {
+      break;
+    }
+
+    // After the potential update all shortest paths have reduced cost 0, so
+    // a blocking flow on these edges can augment many paths at once. The path
+    // found by Dijkstra is the fallback if rounding hides all of them.
+    if (blocking_flow_ && augment_blocking_flow(target_flow) > 0) {
+      continue;
     }
 
     // change capacities
     NodeIndex cur_node = t_;
     do {
-      Edge& forward_edge = e_[edge_taken_to[cur_node]];
-      forward_edge.capacity = 0;
-      e_[forward_edge.opposite].capacity = 1;
-      cur_node = e_[forward_edge.opposite].to;
+      EdgeIndex forward_edge = parent_edge_[cur_node];
+      edge_capacity_[forward_edge] = 0;
+      edge_capacity_[edge_opposite_[forward_edge]] = 1;
+      cur_node = edge_from(forward_edge);
     } while (cur_node != s_);
+
+    ++flow_value_;
+    ++num_augmenting_paths;
   }
+}
 
-  //print_full_graph();
+// Certificate for the pruned network: the flow is optimal for the full
+// network if the potentials can be extended to the pruned nodes such that
+// all residual edges have non-negative reduced cost. The pruned nodes carry
+// no flow, so their edges are forward edges. Column by column, a pruned
+// innode gets the largest potential its incoming edges allow (the potential
+// of the source in the first column, otherwise a windowed L1 distance
+// transform of the outnode potentials of the previous column), and
+// a pruned outnode gets the potential of its innode plus the node cost. The
+// edges into pruned nodes then have non-negative reduced cost by
+// construction, and only the edges from pruned outnodes to innodes in the
+// graph and to the sink remain to be checked.
+// The end node of every violated edge gets the potential that satisfies the
+// edge, which can break the reduced costs of its own edges (see run_flow).
+// With add_entries, the start entries of the violated edges are also added
+// to the candidates. Returns the number of violated edges.
+template <typename PriorityQueue>
+int EMDFlowNetworkSAP<PriorityQueue>::check_candidates(double lambda,
+    bool add_entries) {
+  ++num_candidate_checks;
+
+  Cost max_potential = 0;
+  for (size_t ii = 0; ii < potential_.size(); ++ii) {
+    if (abs(potential_[ii]) < CostTraits<Cost>::infinity()) {
+      max_potential = max(max_potential, abs(potential_[ii]));
+    }
+  }
+  Cost tolerance = CostTraits<Cost>::tolerance(max_potential);
+  Cost lambda_cost = CostTraits<Cost>::quantize(lambda, scale_);
+
+  // outnode potentials of the current column, of all entries and of the
+  // pruned entries only (infinity for the entries in the graph)
+  vector<Cost> out_all(r_);
+  vector<Cost> out_pruned(r_);
+  vector<Cost> in_potential(r_);
+  vector<Cost> transform(r_);
+  vector<int> argmin(r_);
+  vector<int> queue;
+  // start entries of the violated edges
+  vector<pair<int, int> > violated;
+
+  for (int col = 0; col < c_; ++col) {
+    if (col == 0) {
+      fill(in_potential.begin(), in_potential.end(), potential_[s_]);
+    } else {
+      distance_transform(&(out_all[0]), r_, lambda_cost, max_shift_,
+          &(in_potential[0]), NULL, &queue);
+
+      // edges from pruned outnodes of the previous column
+      distance_transform(&(out_pruned[0]), r_, lambda_cost, max_shift_,
+          &(transform[0]), &(argmin[0]), &queue);
+      for (int row = 0; row < r_; ++row) {
+        NodeIndex innode = innode_index(row, col);
+        if (in_graph(entry_index(row, col))
+            && potential_[innode] > transform[row] + tolerance) {
+          violated.push_back(make_pair(argmin[row], col - 1));
+          potential_[innode] = transform[row];
+        }
+      }
+    }
+
+    for (int row = 0; row < r_; ++row) {
+      size_t entry = entry_index(row, col);
+      if (in_graph(entry)) {
+        out_all[row] = potential_[outnode_index(row, col)];
+        out_pruned[row] = CostTraits<Cost>::infinity();
+      } else {
+        out_all[row] = in_potential[row]
+            - CostTraits<Cost>::quantize(a_[entry], scale_);
+        out_pruned[row] = out_all[row];
+      }
+    }
+  }
+
+  // edges from pruned outnodes of the last column to the sink
+  for (int row = 0; row < r_; ++row) {
+    if (!in_graph(entry_index(row, c_ - 1))
+        && out_pruned[row] < potential_[t_] - tolerance) {
+      violated.push_back(make_pair(row, c_ - 1));
+      potential_[t_] = out_pruned[row];
+    }
+  }
+
+  if (!add_entries) {
+    return violated.size();
+  }
+  int num_added = 0;
+  for (size_t ii = 0; ii < violated.size(); ++ii) {
+    int row = violated[ii].first;
+    int col = violated[ii].second;
+    if (!candidates_.mask[row][col]) {
+      candidates_.mask[row][col] = true;
+      ++num_added;
+    }
+  }
+  close_EMD_flow_candidates(max_shift_, &candidates_.mask);
+  num_added_candidates += num_added;
+  return violated.size();
+}
+
+// Successive shortest paths computes the optimal flows for all flow values
+// in increasing order, so every augmenting path is one step of the sweep.
+template <typename PriorityQueue>
+bool EMDFlowNetworkSAP<PriorityQueue>::run_flow_sweep(double lambda,
+    int max_k, std::vector<EMDFlowSparsityStep>* steps) {
+  // the certificate of run_flow covers only a single flow value
+  if (pruned_) {
+    return false;
+  }
+  apply_lambda(lambda);
+  ++num_cold_starts;
+  reset_flow();
+  compute_initial_potential();
+
+  steps->clear();
+  int emd_cost = 0;
+  double amp_sum = 0.0;
+  for (int total_flow = 0; total_flow < min(max_k, r_); ++total_flow) {
+    if (!find_shortest_path()) {
+      break;
+    }
+
+    steps->push_back(EMDFlowSparsityStep());
+    EMDFlowSparsityStep& step = steps->back();
+    step.emd_cost = emd_cost;
+    step.amp_sum = amp_sum;
+
+    NodeIndex cur_node = t_;
+    do {
+      EdgeIndex forward_edge = parent_edge_[cur_node];
+      edge_capacity_[forward_edge] = 0;
+      edge_capacity_[edge_opposite_[forward_edge]] = 1;
+      add_edge_to_step(forward_edge, &step);
+      cur_node = edge_from(forward_edge);
+    } while (cur_node != s_);
+
+    emd_cost = step.emd_cost;
+    amp_sum = step.amp_sum;
+    ++flow_value_;
+    ++num_augmenting_paths;
+  }
+  return true;
 }
 
-int EMDFlowNetworkSAP::get_EMD_used() {
+// Records the effect of pushing one unit of flow along edge e.
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::add_edge_to_step(EdgeIndex e,
+    EMDFlowSparsityStep* step) {
+  NodeIndex from = edge_from(e);
+  NodeIndex to = edge_to_[e];
+  if (from == s_ || from == t_ || to == s_ || to == t_) {
+    return;
+  }
+
+  size_t from_entry = (from - 1) / 2;
+  size_t to_entry = (to - 1) / 2;
+  if (from_entry == to_entry) {
+    // innode -> outnode edge or its reverse
+    pair<int, int> entry(from_entry % r_, from_entry / r_);
+    if (from < to) {
+      step->added_entries.push_back(entry);
+      step->amp_sum += a_[from_entry];
+    } else {
+      step->removed_entries.push_back(entry);
+      step->amp_sum -= a_[from_entry];
+    }
+  } else {
+    int shift = abs(static_cast<int>(from_entry % r_)
+        - static_cast<int>(to_entry % r_));
+    step->emd_cost += (from < to) ? shift : -shift;
+  }
+}
+
+template <typename PriorityQueue>
+int EMDFlowNetworkSAP<PriorityQueue>::get_EMD_used() {
   int emd_cost = 0;
-  for (int row = 0; row < r_; ++row) {
-    for (int col = 0; col < c_ - 1; ++col) {
-      for (int dest = 0; dest < r_; ++dest) {
-        if (e_[emd_edges_[row][col][dest]].capacity == 0) {
+  for (int col = 0; col < c_ - 1; ++col) {
+    NodeIndex first_innode = innode_index(0, col + 1);
+    for (int row = 0; row < r_; ++row) {
+      EdgeIndex end = first_out_[outnode_index(row, col) + 1];
+      for (EdgeIndex e = emd_edges_[entry_index(row, col)]; e < end; ++e) {
+        if (edge_capacity_[e] == 0) {
+          int dest = (edge_to_[e] - first_innode) / 2;
           emd_cost += abs(row - dest);
         }
       }
@@ -310,19 +1005,23 @@ int EMDFlowNetworkSAP::get_EMD_used() {
   return emd_cost;
 }
 
-double EMDFlowNetworkSAP::get_supported_amplitude_sum() {
+template <typename PriorityQueue>
+double EMDFlowNetworkSAP<PriorityQueue>::get_supported_amplitude_sum() {
   double amp_sum = 0;
   for (int row = 0; row < r_; ++row) {
     for (int col = 0; col < c_; ++col) {
-      if (e_[node_edges_[row][col]].capacity == 0) {
-        amp_sum += abs(a_[row][col]);
+      size_t entry = entry_index(row, col);
+      if (in_graph(entry) && edge_capacity_[node_edges_[entry]] == 0) {
+        amp_sum += a_[entry];
       }
     }
   }
   return amp_sum;
 }
 
-void EMDFlowNetworkSAP::get_support(std::vector<std::vector<bool> >* support) {
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::get_support(
+    std::vector<std::vector<bool> >* support) {
   if (static_cast<int>(support->size()) != r_) {
     support->resize(r_);
   }
@@ -331,33 +1030,108 @@ void EMDFlowNetworkSAP::get_support(std::vector<std::vector<bool> >* support) {
       (*support)[row].resize(c_);
     }
     for (int col = 0; col < c_; ++col) {
-      (*support)[row][col] = (e_[node_edges_[row][col]].capacity == 0);
+      size_t entry = entry_index(row, col);
+      (*support)[row][col] =
+          (in_graph(entry) && edge_capacity_[node_edges_[entry]] == 0);
     }
   }
 }
 
-int EMDFlowNetworkSAP::get_num_nodes() {
-  return outgoing_edges_.size();
+template <typename PriorityQueue>
+int EMDFlowNetworkSAP<PriorityQueue>::get_num_nodes() {
+  if (!pruned_) {
+    return potential_.size();
+  }
+  int num_nodes = 2;
+  for (size_t entry = 0; entry < a_.size(); ++entry) {
+    if (in_graph(entry)) {
+      num_nodes += 2;
+    }
+  }
+  return num_nodes;
+}
+
+// The clone shares the topology and copies the costs, capacities and
+// options; the flow is reset so that the clone does not depend on the
+// history of this network.
+template <typename PriorityQueue>
+EMDFlowNetwork* EMDFlowNetworkSAP<PriorityQueue>::clone() {
+  EMDFlowNetworkSAP<PriorityQueue>* network =
+      new EMDFlowNetworkSAP<PriorityQueue>(*this);
+  network->total_inner_iterations = 0;
+  network->checking_inner_iterations = 0;
+  network->updating_inner_iterations = 0;
+  network->num_cold_starts = 0;
+  network->num_warm_starts = 0;
+  network->num_cancelled_cycles = 0;
+  network->num_dijkstra_runs = 0;
+  network->num_settled_nodes = 0;
+  network->num_augmenting_paths = 0;
+  network->num_graph_builds = 0;
+  network->num_candidate_checks = 0;
+  network->num_potential_repairs = 0;
+  network->num_added_candidates = 0;
+  network->flow_value_ = 0;
+  network->set_sparsity(0);
+  return network;
 }
 
-int EMDFlowNetworkSAP::get_num_edges() {
-  return e_.size();
+template <typename PriorityQueue>
+int EMDFlowNetworkSAP<PriorityQueue>::get_num_edges() {
+  return num_edges_;
 }
 
-int EMDFlowNetworkSAP::get_num_columns() {
+template <typename PriorityQueue>
+int EMDFlowNetworkSAP<PriorityQueue>::get_num_columns() {
   return c_;
 }
 
-int EMDFlowNetworkSAP::get_num_rows() {
+template <typename PriorityQueue>
+int EMDFlowNetworkSAP<PriorityQueue>::get_num_rows() {
   return r_;
 }
 
-void EMDFlowNetworkSAP::get_performance_diagnostics(std::string* s) {
+template <typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::get_performance_diagnostics(
+    std::string* s) {
   const size_t tmp_size = 2000;
   char tmp[tmp_size];
   snprintf(tmp, tmp_size, "Total inner iterations: %lld\n"
-      "Checking inner iterations: %lld\nUpdating inner iterations: %lld\n",
+      "Checking inner iterations: %lld\nUpdating inner iterations: %lld\n"
+      "Cold starts: %lld\nWarm starts: %lld\n"
+      "Cancelled cycles: %lld\nDijkstra runs: %lld\nSettled nodes: %lld\n"
+      "Augmenting paths: %lld\n"
+      "Heap pushes: %lld\nHeap pops: %lld\nHeap decrease-keys: %lld\n"
+      "Graph builds: %lld\nCandidate checks: %lld\n"
+      "Potential repairs: %lld\nAdded candidates: %lld\n",
       total_inner_iterations, checking_inner_iterations,
-      updating_inner_iterations);
+      updating_inner_iterations, num_cold_starts, num_warm_starts,
+      num_cancelled_cycles, num_dijkstra_runs, num_settled_nodes,
+      num_augmenting_paths,
+      queue_.num_pushes, queue_.num_pops,
+      queue_.num_decrease_keys, num_graph_builds, num_candidate_checks,
+      num_potential_repairs, num_added_candidates);
   *s = string(tmp);
 }
+
+template<typename PriorityQueue>
+void EMDFlowNetworkSAP<PriorityQueue>::get_statistics(
+    EMDFlowNetworkStats* stats) {
+  stats->num_dijkstra_runs = num_dijkstra_runs;
+  stats->num_settled_nodes = num_settled_nodes;
+  stats->num_edge_scans = total_inner_iterations;
+  stats->num_relaxations = updating_inner_iterations;
+  stats->num_heap_pushes = queue_.num_pushes;
+  stats->num_heap_pops = queue_.num_pops;
+  stats->num_heap_decrease_keys = queue_.num_decrease_keys;
+  stats->max_heap_size = queue_.max_size;
+  stats->num_augmenting_paths = num_augmenting_paths;
+}
+
+template class EMDFlowNetworkSAP<LazyBinaryHeap<double> >;
+template class EMDFlowNetworkSAP<IndexedDaryHeap<4, double> >;
+template class EMDFlowNetworkSAP<PairingHeap<double> >;
+template class EMDFlowNetworkSAP<LazyBinaryHeap<long long> >;
+template class EMDFlowNetworkSAP<IndexedDaryHeap<4, long long> >;
+template class EMDFlowNetworkSAP<PairingHeap<long long> >;
+template class EMDFlowNetworkSAP<RadixHeap>;
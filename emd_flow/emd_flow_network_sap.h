@@ -2,13 +2,35 @@
 #define __EMD_FLOW_NETWORK_SAP_H__
 
 #include "emd_flow_network.h"
+#include "priority_queues.h"
+#include "cost_traits.h"
+#include "emd_flow_candidates.h"
 
 #include <vector>
+#include <memory>
+#include <limits>
 #include <cstddef>
-
+#include <stdint.h>
+
+// The priority queue used in the Dijkstra searches is a template parameter
+// (see priority_queues.h). Its key type is also the cost type of the
+// network: double, or long long for quantized integer costs (see
+// cost_traits.h). The instantiations for LazyBinaryHeap, IndexedDaryHeap<4>
+// and PairingHeap with both cost types and for RadixHeap (integer costs only)
+// are compiled in emd_flow_network_sap.cc.
+template <typename PriorityQueue>
 class EMDFlowNetworkSAP : public EMDFlowNetwork {
  public:
-  EMDFlowNetworkSAP(const std::vector<std::vector<double> >& amplitudes);
+  // Only column arcs that shift by at most max_shift rows are built (all
+  // arcs if max_shift is negative).
+  EMDFlowNetworkSAP(const EMDFlowAmplitudes& amplitudes,
+      int max_shift);
+  // Builds the graph only on the candidate entries. With candidates.verify,
+  // every run_flow checks the flow against the pruned entries and adds the
+  // ones that could improve it (see run_flow). A pruned network does not
+  // support run_flow_sweep.
+  EMDFlowNetworkSAP(const EMDFlowAmplitudes& amplitudes,
+      int max_shift, const EMDFlowCandidates& candidates);
   void set_sparsity(int k);
   void run_flow(double lambda);
   int get_EMD_used();
@@ -19,66 +41,180 @@ class EMDFlowNetworkSAP : public EMDFlowNetwork {
   int get_num_columns();
   int get_num_rows();
   void get_performance_diagnostics(std::string* s);
+  void get_statistics(EMDFlowNetworkStats* stats);
+  void set_warm_start(bool warm_start);
+  void set_blocking_flow(bool blocking_flow);
+  bool run_flow_sweep(double lambda, int max_k,
+      std::vector<EMDFlowSparsityStep>* steps);
+  EMDFlowNetwork* clone();
+  bool update_amplitudes(const EMDFlowAmplitudes& amplitudes,
+      bool keep_flow);
   ~EMDFlowNetworkSAP() { }
 
  private:
-  // node indices:
+  // node indices (column by column, so that neighbouring columns are close
+  // in memory):
   // source: 0
-  // sink: 1
-  // other innode: 2 + 2 * (c_ * num_rows + r_)
-  // other outnode: 3 + 2 * (c_ * num_rows + r_)
-  typedef size_t NodeIndex;
-  typedef size_t EdgeIndex;
-
-  struct Edge {
-    NodeIndex to;
-    int capacity;
-    double cost;
-    EdgeIndex opposite;
-
-    Edge(NodeIndex _to, int _capacity, double _cost, EdgeIndex _opposite)
-        : to(_to), capacity(_capacity), cost(_cost), opposite(_opposite) { }
-  };
-
-  // amplitudes
-  std::vector<std::vector<double> > a_;
+  // innode: 1 + 2 * (c * num_rows + r)
+  // outnode: 2 + 2 * (c * num_rows + r)
+  // sink: 1 + 2 * num_rows * num_columns
+  typedef uint32_t NodeIndex;
+  typedef uint32_t EdgeIndex;
+  typedef typename PriorityQueue::Key Cost;
+
+  // amplitudes (absolute values), stored column by column
+  std::vector<double> a_;
   // sparsity
   int k_;
   // number of rows
   int r_;
   // number of columns
   int c_;
+  // largest row shift between two columns with an arc (negative: no limit)
+  int max_shift_;
+  // factor applied to amplitudes and lambda before rounding them to Cost
+  double scale_;
 
   // source, sink
   NodeIndex s_, t_;
 
-  // edges representing a node cost
-  std::vector<std::vector<EdgeIndex> > node_edges_;
-  // edges representing an EMD step
-  std::vector<std::vector<std::vector<EdgeIndex> > > emd_edges_;
-  // edges leaving a node
-  std::vector<std::vector<EdgeIndex> > outgoing_edges_;
-  // set of all edges
-  std::vector<Edge> e_;
+  // entries the graph is built on (only used if pruned_ is set)
+  EMDFlowCandidates candidates_;
+  // true if some entries are not in the graph
+  bool pruned_;
+
+  // The graph structure only changes when candidates are added, otherwise
+  // only capacities and costs change. It is shared between a network and
+  // its clones.
+  struct Topology {
+    // The edges are stored in CSR format: the edges leaving node n are
+    // first_out[n], ..., first_out[n + 1] - 1.
+    std::vector<EdgeIndex> first_out;
+    std::vector<NodeIndex> edge_to;
+    std::vector<EdgeIndex> edge_opposite;
+    // edges representing a node cost, indexed by c * num_rows + r (no_edge()
+    // for entries that are not in the graph)
+    std::vector<EdgeIndex> node_edges;
+    // first edge representing an EMD step out of an entry, indexed by
+    // c * num_rows + r. The EMD edges are the last edges leaving the
+    // outnode, sorted by destination row.
+    std::vector<EdgeIndex> emd_edges;
+  };
+  std::shared_ptr<const Topology> topology_;
+  // shortcuts into *topology_
+  const EdgeIndex* first_out_;
+  const NodeIndex* edge_to_;
+  const EdgeIndex* edge_opposite_;
+  const EdgeIndex* node_edges_;
+  const EdgeIndex* emd_edges_;
+  size_t num_edges_;
+
+  // per-instance edge data
+  std::vector<Cost> edge_cost_;
+  std::vector<int> edge_capacity_;
 
   // node potentials
-  std::vector<double> potential_;
+  std::vector<Cost> potential_;
+  // queue for the Dijkstra searches, sized once for all nodes
+  PriorityQueue queue_;
+  // Dijkstra state, valid only if the corresponding epoch matches
+  std::vector<Cost> dst_;
+  std::vector<EdgeIndex> parent_edge_;
+  std::vector<int> seen_epoch_;
+  std::vector<int> done_epoch_;
+  std::vector<NodeIndex> settled_;
+  int epoch_;
+  // DFS state of the blocking flow phase
+  std::vector<EdgeIndex> current_edge_;
+  std::vector<char> on_path_;
+  std::vector<EdgeIndex> path_;
+
+  // re-optimize the previous flow when lambda changes
+  bool warm_start_;
+  // augment all shortest paths found after a Dijkstra run
+  bool blocking_flow_;
+  // number of flow units currently routed through the network
+  int flow_value_;
 
   long long total_inner_iterations;
   long long checking_inner_iterations;
   long long updating_inner_iterations;
+  long long num_cold_starts;
+  long long num_warm_starts;
+  long long num_cancelled_cycles;
+  long long num_dijkstra_runs;
+  long long num_settled_nodes;
+  long long num_augmenting_paths;
+  long long num_graph_builds;
+  long long num_candidate_checks;
+  long long num_potential_repairs;
+  long long num_added_candidates;
+
+  static EdgeIndex no_edge() {
+    return std::numeric_limits<EdgeIndex>::max();
+  }
+
+  size_t entry_index(int r, int c) {
+    return c * r_ + r;
+  }
 
   NodeIndex innode_index(int r, int c) {
-    return 2 + 2 * (c * r_ + r);
+    return 1 + 2 * entry_index(r, c);
   }
 
   NodeIndex outnode_index(int r, int c) {
     return innode_index(r, c) + 1;
   }
 
+  // node the edge starts at
+  NodeIndex edge_from(EdgeIndex e) {
+    return edge_to_[edge_opposite_[e]];
+  }
+
+  bool is_candidate(int r, int c) {
+    return !pruned_ || candidates_.mask[r][c];
+  }
+
+  // only valid after the graph is built
+  bool in_graph(size_t entry) {
+    return node_edges_[entry] != no_edge();
+  }
+
+  // range of rows in the next column reachable from row r
+  int first_dest(int r) {
+    return (max_shift_ < 0 || r < max_shift_) ? 0 : r - max_shift_;
+  }
+
+  int last_dest(int r) {
+    return (max_shift_ < 0 || r + max_shift_ >= r_) ? r_ - 1 : r + max_shift_;
+  }
+
+  // 0 for the source, column + 1 for the matrix nodes, c_ + 1 for the sink
+  size_t bucket_index(NodeIndex n) {
+    if (n == s_) {
+      return 0;
+    } else if (n == t_) {
+      return c_ + 1;
+    } else {
+      return (n - 1) / (2 * r_) + 1;
+    }
+  }
+
+  void read_amplitudes(const EMDFlowAmplitudes& amplitudes);
+  void build_graph();
+  EdgeIndex add_edge_pair(NodeIndex from, NodeIndex to, Cost cost,
+      std::vector<NodeIndex>* edge_from, Topology* topology);
+  void build_csr(const std::vector<NodeIndex>& edge_from,
+      Topology* topology);
   void apply_lambda(double lambda);
   void reset_flow();
   void compute_initial_potential();
+  void compute_flow();
+  int check_candidates(double lambda, bool add_entries);
+  bool reoptimize_flow();
+  bool find_shortest_path();
+  int augment_blocking_flow(int target_flow);
+  void add_edge_to_step(EdgeIndex e, EMDFlowSparsityStep* step);
   void print_full_graph();
 };
 
@@ -0,0 +1,415 @@
+#include "emd_flow_network_sap_l1.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+EMDFlowNetworkSAPL1::EMDFlowNetworkSAPL1(
+    const EMDFlowAmplitudes& amplitudes) : k_(0),
+    lambda_(0.0), epoch_(0), total_inner_iterations(0),
+    updating_inner_iterations(0), num_dijkstra_runs(0), num_settled_nodes(0),
+    num_augmenting_paths(0), num_heap_pushes(0), num_heap_pops(0),
+    max_heap_size(0) {
+  r_ = amplitudes.num_rows();
+  c_ = amplitudes.num_columns();
+
+  a_.resize(r_ * c_);
+  for (int row = 0; row < r_; ++row) {
+    for (int col = 0; col < c_; ++col) {
+      a_[entry_index(row, col)] = abs(amplitudes(row, col));
+    }
+  }
+
+  // source and sink
+  s_ = 0;
+  t_ = 1;
+
+  first_transfer_node_ = 2 + 2 * r_ * c_;
+  num_nodes_ = first_transfer_node_ + r_ * (c_ - 1);
+
+  node_used_.resize(r_ * c_);
+  next_row_.resize(r_ * c_);
+  prev_row_.resize(r_ * c_);
+
+  potential_.resize(first_transfer_node_);
+  transfer_potential_.resize(r_ * (c_ - 1));
+  transfer_potential_epoch_.resize(c_, 0);
+
+  dst_.resize(num_nodes_);
+  parent_.resize(num_nodes_);
+  seen_epoch_.resize(num_nodes_, 0);
+  done_epoch_.resize(num_nodes_, 0);
+
+  reset_flow();
+  set_sparsity(0);
+}
+
+void EMDFlowNetworkSAPL1::reset_flow() {
+  fill(node_used_.begin(), node_used_.end(), 0);
+  fill(next_row_.begin(), next_row_.end(), -1);
+  fill(prev_row_.begin(), prev_row_.end(), -1);
+}
+
+void EMDFlowNetworkSAPL1::compute_initial_potential() {
+  // source and first column
+  potential_[s_] = 0.0;
+  for (int row = 0; row < r_; ++row) {
+    potential_[innode_index(row, 0)] = 0.0;
+    potential_[outnode_index(row, 0)] = -a_[entry_index(row, 0)];
+  }
+
+  // distance transform from the outnodes of a column to the innodes of the
+  // next column, then innode to outnode
+  vector<double> tmp(r_);
+  for (int col = 0; col < c_ - 1; ++col) {
+    tmp[0] = potential_[outnode_index(0, col)];
+    for (int row = 1; row < r_; ++row) {
+      tmp[row] = min(potential_[outnode_index(row, col)],
+          tmp[row - 1] + lambda_);
+    }
+    for (int row = r_ - 2; row >= 0; --row) {
+      tmp[row] = min(tmp[row], tmp[row + 1] + lambda_);
+    }
+
+    for (int row = 0; row < r_; ++row) {
+      potential_[innode_index(row, col + 1)] = tmp[row];
+      potential_[outnode_index(row, col + 1)] =
+          tmp[row] - a_[entry_index(row, col + 1)];
+    }
+  }
+
+  // last column to sink
+  potential_[t_] = numeric_limits<double>::infinity();
+  for (int row = 0; row < r_; ++row) {
+    potential_[t_] = min(potential_[t_],
+        potential_[outnode_index(row, c_ - 1)]);
+  }
+}
+
+// The transfer nodes carry no flow, so their potentials are not stored across
+// Dijkstra runs. The distance transform of the outnode potentials is a valid
+// choice: it keeps all reduced costs along the transfer chain non-negative
+// because the innode potentials never exceed
+// potential(outnode(r, c)) + lambda * |r - d|.
+void EMDFlowNetworkSAPL1::compute_transfer_potential(int col) {
+  double* tp = &(transfer_potential_[entry_index(0, col)]);
+  tp[0] = potential_[outnode_index(0, col)];
+  for (int row = 1; row < r_; ++row) {
+    tp[row] = min(potential_[outnode_index(row, col)], tp[row - 1] + lambda_);
+  }
+  for (int row = r_ - 2; row >= 0; --row) {
+    tp[row] = min(tp[row], tp[row + 1] + lambda_);
+  }
+  transfer_potential_epoch_[col] = epoch_;
+}
+
+double EMDFlowNetworkSAPL1::potential(NodeIndex n) {
+  if (n < first_transfer_node_) {
+    return potential_[n];
+  }
+  size_t index = n - first_transfer_node_;
+  int col = index / r_;
+  if (transfer_potential_epoch_[col] != epoch_) {
+    compute_transfer_potential(col);
+  }
+  return transfer_potential_[index];
+}
+
+void EMDFlowNetworkSAPL1::push(double dst, NodeIndex n) {
+  q_.push(make_pair(-dst, n));
+  if (EMD_FLOW_STATS) {
+    ++num_heap_pushes;
+    max_heap_size = max(max_heap_size, static_cast<long long>(q_.size()));
+  }
+}
+
+void EMDFlowNetworkSAPL1::relax(NodeIndex from, NodeIndex to, double cost) {
+  if (EMD_FLOW_STATS) {
+    ++total_inner_iterations;
+  }
+
+  if (done_epoch_[to] == epoch_) {
+    return;
+  }
+
+  double new_dst = dst_[from] + cost + potential(from) - potential(to);
+  if (seen_epoch_[to] != epoch_ || new_dst < dst_[to]) {
+    seen_epoch_[to] = epoch_;
+    dst_[to] = new_dst;
+    parent_[to] = from;
+    push(new_dst, to);
+
+    if (EMD_FLOW_STATS) {
+      ++updating_inner_iterations;
+    }
+  }
+}
+
+bool EMDFlowNetworkSAPL1::find_shortest_path() {
+  // the networks live across many solves, so the epoch can wrap around
+  if (epoch_ == numeric_limits<int>::max()) {
+    fill(transfer_potential_epoch_.begin(), transfer_potential_epoch_.end(),
+        0);
+    fill(seen_epoch_.begin(), seen_epoch_.end(), 0);
+    fill(done_epoch_.begin(), done_epoch_.end(), 0);
+    epoch_ = 0;
+  }
+  ++epoch_;
+  ++num_dijkstra_runs;
+  settled_.clear();
+  while (!q_.empty()) {
+    q_.pop();
+  }
+
+  seen_epoch_[s_] = epoch_;
+  dst_[s_] = 0.0;
+  parent_[s_] = s_;
+  push(0.0, s_);
+
+  while (!q_.empty()) {
+    NodeIndex cur = q_.top().second;
+    q_.pop();
+    if (EMD_FLOW_STATS) {
+      ++num_heap_pops;
+    }
+
+    if (done_epoch_[cur] == epoch_) {
+      continue;
+    }
+    done_epoch_[cur] = epoch_;
+    settled_.push_back(cur);
+    if (EMD_FLOW_STATS) {
+      ++num_settled_nodes;
+    }
+
+    if (cur == t_) {
+      break;
+    }
+
+    if (cur == s_) {
+      for (int row = 0; row < r_; ++row) {
+        if (!node_used_[entry_index(row, 0)]) {
+          relax(cur, innode_index(row, 0), 0.0);
+        }
+      }
+    } else if (cur < first_transfer_node_) {
+      size_t entry = (cur - 2) / 2;
+      int col = entry / r_;
+      int row = entry % r_;
+      bool is_innode = ((cur - 2) % 2 == 0);
+
+      if (is_innode) {
+        if (!node_used_[entry]) {
+          relax(cur, cur + 1, -a_[entry]);
+        } else if (col == 0) {
+          relax(cur, s_, 0.0);
+        } else {
+          int prev = prev_row_[entry];
+          relax(cur, outnode_index(prev, col - 1), -lambda_ * abs(prev - row));
+        }
+      } else {
+        if (node_used_[entry]) {
+          relax(cur, cur - 1, a_[entry]);
+        }
+        if (col == c_ - 1) {
+          if (!node_used_[entry]) {
+            relax(cur, t_, 0.0);
+          }
+        } else {
+          relax(cur, transfer_node_index(row, col), 0.0);
+        }
+      }
+    } else {
+      size_t index = cur - first_transfer_node_;
+      int col = index / r_;
+      int row = index % r_;
+      if (row > 0) {
+        relax(cur, cur - 1, lambda_);
+      }
+      if (row < r_ - 1) {
+        relax(cur, cur + 1, lambda_);
+      }
+      relax(cur, innode_index(row, col + 1), 0.0);
+    }
+  }
+
+  if (done_epoch_[t_] != epoch_) {
+    return false;
+  }
+
+  // Shifting all distances by the distance of the sink means that only the
+  // settled nodes get new potentials.
+  double sink_dst = dst_[t_];
+  for (size_t ii = 0; ii < settled_.size(); ++ii) {
+    if (settled_[ii] < first_transfer_node_) {
+      potential_[settled_[ii]] += dst_[settled_[ii]] - sink_dst;
+    }
+  }
+  return true;
+}
+
+void EMDFlowNetworkSAPL1::augment() {
+  ++num_augmenting_paths;
+  NodeIndex cur = t_;
+  while (cur != s_) {
+    NodeIndex prev = parent_[cur];
+
+    if (cur != t_ && cur < first_transfer_node_) {
+      size_t entry = (cur - 2) / 2;
+      int col = entry / r_;
+      int row = entry % r_;
+      bool is_innode = ((cur - 2) % 2 == 0);
+
+      if (is_innode) {
+        if (prev >= first_transfer_node_) {
+          // column transition: follow the transfer chain back to the outnode
+          while (parent_[prev] >= first_transfer_node_) {
+            prev = parent_[prev];
+          }
+          prev = parent_[prev];
+          int from_row = ((prev - 2) / 2) % r_;
+          next_row_[entry_index(from_row, col - 1)] = row;
+          prev_row_[entry] = from_row;
+        } else if (prev != s_) {
+          // backward innode -> outnode edge
+          node_used_[entry] = 0;
+        }
+      } else {
+        if (prev == cur - 1) {
+          node_used_[entry] = 1;
+        } else {
+          // backward edge of a column transition
+          int to_row = ((prev - 2) / 2) % r_;
+          size_t to_entry = entry_index(to_row, col + 1);
+          if (next_row_[entry] == to_row) {
+            next_row_[entry] = -1;
+          }
+          if (prev_row_[to_entry] == row) {
+            prev_row_[to_entry] = -1;
+          }
+        }
+      }
+    }
+
+    cur = prev;
+  }
+}
+
+// The network has no explicit edges, the amplitudes are only used through
+// a_. Every run starts from an empty flow, so keep_flow is ignored.
+bool EMDFlowNetworkSAPL1::update_amplitudes(
+    const EMDFlowAmplitudes& amplitudes, bool /*keep_flow*/) {
+  if (amplitudes.num_rows() != r_ || amplitudes.num_columns() != c_) {
+    return false;
+  }
+  for (int row = 0; row < r_; ++row) {
+    for (int col = 0; col < c_; ++col) {
+      a_[entry_index(row, col)] = abs(amplitudes(row, col));
+    }
+  }
+  return true;
+}
+
+void EMDFlowNetworkSAPL1::set_sparsity(int k) {
+  k_ = k;
+}
+
+void EMDFlowNetworkSAPL1::run_flow(double lambda) {
+  lambda_ = lambda;
+
+  reset_flow();
+  compute_initial_potential();
+
+  for (int total_flow = 0; total_flow < min(k_, r_); ++total_flow) {
+    if (!find_shortest_path()) {
+      break;
+    }
+    augment();
+  }
+}
+
+int EMDFlowNetworkSAPL1::get_EMD_used() {
+  int emd_cost = 0;
+  for (int row = 0; row < r_; ++row) {
+    for (int col = 0; col < c_ - 1; ++col) {
+      int dest = next_row_[entry_index(row, col)];
+      if (dest >= 0) {
+        emd_cost += abs(row - dest);
+      }
+    }
+  }
+  return emd_cost;
+}
+
+double EMDFlowNetworkSAPL1::get_supported_amplitude_sum() {
+  double amp_sum = 0;
+  for (int row = 0; row < r_; ++row) {
+    for (int col = 0; col < c_; ++col) {
+      if (node_used_[entry_index(row, col)]) {
+        amp_sum += a_[entry_index(row, col)];
+      }
+    }
+  }
+  return amp_sum;
+}
+
+void EMDFlowNetworkSAPL1::get_support(
+    std::vector<std::vector<bool> >* support) {
+  if (static_cast<int>(support->size()) != r_) {
+    support->resize(r_);
+  }
+  for (int row = 0; row < r_; ++row) {
+    if (static_cast<int>((*support)[row].size()) != c_) {
+      (*support)[row].resize(c_);
+    }
+    for (int col = 0; col < c_; ++col) {
+      (*support)[row][col] = node_used_[entry_index(row, col)];
+    }
+  }
+}
+
+int EMDFlowNetworkSAPL1::get_num_nodes() {
+  return num_nodes_;
+}
+
+int EMDFlowNetworkSAPL1::get_num_edges() {
+  // source, sink, innode -> outnode, and per column transition
+  // outnode -> transfer node, transfer chain, transfer node -> innode
+  return 2 * r_ + r_ * c_ + (c_ - 1) * (2 * r_ + 2 * (r_ - 1));
+}
+
+int EMDFlowNetworkSAPL1::get_num_columns() {
+  return c_;
+}
+
+int EMDFlowNetworkSAPL1::get_num_rows() {
+  return r_;
+}
+
+void EMDFlowNetworkSAPL1::get_performance_diagnostics(std::string* s) {
+  const size_t tmp_size = 2000;
+  char tmp[tmp_size];
+  snprintf(tmp, tmp_size, "Total inner iterations: %lld\n"
+      "Updating inner iterations: %lld\nDijkstra runs: %lld\n"
+      "Settled nodes: %lld\nAugmenting paths: %lld\n",
+      total_inner_iterations, updating_inner_iterations, num_dijkstra_runs,
+      num_settled_nodes, num_augmenting_paths);
+  *s = string(tmp);
+}
+
+void EMDFlowNetworkSAPL1::get_statistics(EMDFlowNetworkStats* stats) {
+  stats->num_dijkstra_runs = num_dijkstra_runs;
+  stats->num_settled_nodes = num_settled_nodes;
+  stats->num_edge_scans = total_inner_iterations;
+  stats->num_relaxations = updating_inner_iterations;
+  stats->num_heap_pushes = num_heap_pushes;
+  stats->num_heap_pops = num_heap_pops;
+  // std::priority_queue has no decrease-key
+  stats->num_heap_decrease_keys = 0;
+  stats->max_heap_size = max_heap_size;
+  stats->num_augmenting_paths = num_augmenting_paths;
+}
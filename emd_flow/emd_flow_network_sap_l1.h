@@ -0,0 +1,123 @@
+#ifndef __EMD_FLOW_NETWORK_SAP_L1_H__
+#define __EMD_FLOW_NETWORK_SAP_L1_H__
+
+#include "emd_flow_network.h"
+
+#include <vector>
+#include <queue>
+#include <utility>
+#include <cstddef>
+
+// Shortest augmenting path algorithm that never builds the r^2 arcs between
+// two columns. Since the cost of moving from row r to row d is
+// lambda * |r - d|, every column transition is routed through a chain of
+// implicit transfer nodes (one per row) with arcs of cost lambda between
+// neighbouring rows. This is the Dijkstra-compatible form of the two-pass
+// L1 distance transform and makes each column transition O(r) instead of
+// O(r^2). The backward residual arcs of the (at most k) flow-carrying column
+// transitions are stored separately.
+class EMDFlowNetworkSAPL1 : public EMDFlowNetwork {
+ public:
+  EMDFlowNetworkSAPL1(const EMDFlowAmplitudes& amplitudes);
+  void set_sparsity(int k);
+  void run_flow(double lambda);
+  int get_EMD_used();
+  double get_supported_amplitude_sum();
+  void get_support(std::vector<std::vector<bool> >* support);
+  int get_num_nodes();
+  int get_num_edges();
+  int get_num_columns();
+  int get_num_rows();
+  void get_performance_diagnostics(std::string* s);
+  void get_statistics(EMDFlowNetworkStats* stats);
+  bool update_amplitudes(const EMDFlowAmplitudes& amplitudes,
+      bool keep_flow);
+  ~EMDFlowNetworkSAPL1() { }
+
+ private:
+  // node indices:
+  // source: 0
+  // sink: 1
+  // innode: 2 + 2 * (c * num_rows + r)
+  // outnode: 3 + 2 * (c * num_rows + r)
+  // transfer node between column c and c + 1:
+  //     2 + 2 * num_rows * num_columns + c * num_rows + r
+  typedef size_t NodeIndex;
+
+  // amplitudes, stored column by column
+  std::vector<double> a_;
+  // sparsity
+  int k_;
+  // number of rows
+  int r_;
+  // number of columns
+  int c_;
+  // current lambda
+  double lambda_;
+
+  // source, sink
+  NodeIndex s_, t_;
+  // first transfer node
+  NodeIndex first_transfer_node_;
+  // total number of nodes including the transfer nodes
+  size_t num_nodes_;
+
+  // flow state, all indexed by c * num_rows + r:
+  // flow through the matrix entry
+  std::vector<char> node_used_;
+  // row in the next column the outnode sends its flow to (or -1)
+  std::vector<int> next_row_;
+  // row in the previous column the innode receives its flow from (or -1)
+  std::vector<int> prev_row_;
+
+  // potentials of the source, sink, innodes and outnodes
+  std::vector<double> potential_;
+  // potentials of the transfer nodes, recomputed in every Dijkstra run
+  std::vector<double> transfer_potential_;
+  std::vector<int> transfer_potential_epoch_;
+
+  // Dijkstra state, valid only if the corresponding epoch matches
+  std::vector<double> dst_;
+  std::vector<NodeIndex> parent_;
+  std::vector<int> seen_epoch_;
+  std::vector<int> done_epoch_;
+  std::vector<NodeIndex> settled_;
+  std::priority_queue<std::pair<double, NodeIndex> > q_;
+  int epoch_;
+
+  long long total_inner_iterations;
+  long long updating_inner_iterations;
+  long long num_dijkstra_runs;
+  long long num_settled_nodes;
+  long long num_augmenting_paths;
+  long long num_heap_pushes;
+  long long num_heap_pops;
+  long long max_heap_size;
+
+  size_t entry_index(int r, int c) {
+    return c * r_ + r;
+  }
+
+  NodeIndex innode_index(int r, int c) {
+    return 2 + 2 * entry_index(r, c);
+  }
+
+  NodeIndex outnode_index(int r, int c) {
+    return innode_index(r, c) + 1;
+  }
+
+  NodeIndex transfer_node_index(int r, int c) {
+    return first_transfer_node_ + entry_index(r, c);
+  }
+
+  double potential(NodeIndex n);
+  void compute_transfer_potential(int col);
+  void relax(NodeIndex from, NodeIndex to, double cost);
+  void push(double dst, NodeIndex n);
+  void reset_flow();
+  void compute_initial_potential();
+  bool find_shortest_path();
+  void augment();
+};
+
+#endif
@@ -0,0 +1,338 @@
+#include "emd_flow_server.h"
+#include "emd_flow_io.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+// State of one stream of EMDFlowServer::serve: the reader (the calling
+// thread) puts the problems into a bounded queue, the workers take them
+// from the queue, and the results are written in the order of the problems
+// by the worker that completes the next one.
+class EMDFlowServerStream {
+ public:
+  EMDFlowServerStream(EMDFlowServer* server, FILE* out)
+      : server_(server), out_(out), done_(false), next_result_(0) {
+    max_queued_ = 2 * server_->workers_.size();
+  }
+
+  bool run(FILE* in, string* error) {
+    vector<thread> threads;
+    for (size_t ii = 0; ii < server_->workers_.size(); ++ii) {
+      threads.push_back(thread(&EMDFlowServerStream::work, this, ii));
+    }
+
+    bool ok = true;
+    for (size_t index = 0; ; ++index) {
+      Task* task = new Task;
+      task->index = index;
+      task->status = EMDFlowServer::kOk;
+      if (!read_binary_frame(in, &(task->problem), error)) {
+        if (error->empty()) {
+          delete task;
+          break;
+        }
+        task->status = EMDFlowServer::kMalformedFrame;
+        ok = false;
+      } else if (!valid(task->problem)) {
+        task->status = EMDFlowServer::kInvalidProblem;
+        task->problem.a.clear();
+      }
+      {
+        unique_lock<mutex> lock(queue_lock_);
+        while (tasks_.size() >= max_queued_) {
+          not_full_.wait(lock);
+        }
+        tasks_.push_back(task);
+      }
+      not_empty_.notify_one();
+      if (!ok) {
+        break;
+      }
+    }
+
+    {
+      lock_guard<mutex> lock(queue_lock_);
+      done_ = true;
+    }
+    not_empty_.notify_all();
+    for (size_t ii = 0; ii < threads.size(); ++ii) {
+      threads[ii].join();
+    }
+    return ok;
+  }
+
+ private:
+  struct Task {
+    size_t index;
+    int status;
+    EMDFlowInput problem;
+  };
+
+  struct Result {
+    int status;
+    vector<vector<bool> > support;
+    int emd_cost;
+    double amp_sum;
+    double final_lambda;
+  };
+
+  EMDFlowServer* server_;
+  FILE* out_;
+
+  mutex queue_lock_;
+  condition_variable not_empty_;
+  condition_variable not_full_;
+  deque<Task*> tasks_;
+  size_t max_queued_;
+  // true once the reader has put the last problem into the queue
+  bool done_;
+
+  mutex output_lock_;
+  // completed results that wait for the results of earlier problems
+  map<size_t, Result*> pending_;
+  size_t next_result_;
+
+  EMDFlowNetworkFactory::EMDFlowNetworkType get_type(
+      const EMDFlowInput& problem) {
+    if (problem.algorithm == 0) {
+      return server_->options_.alg_type;
+    }
+    return static_cast<EMDFlowNetworkFactory::EMDFlowNetworkType>(
+        problem.algorithm - 1);
+  }
+
+  bool valid(const EMDFlowInput& problem) {
+    return problem.k >= 0 && problem.k <= problem.r
+        && problem.emd_bound_low >= 0
+        && problem.emd_bound_low <= problem.emd_bound_high
+        && problem.algorithm >= 0
+        && problem.algorithm <= EMDFlowNetworkFactory::kUnknownType;
+  }
+
+  void work(int worker) {
+    for (;;) {
+      Task* task = NULL;
+      {
+        unique_lock<mutex> lock(queue_lock_);
+        while (tasks_.empty() && !done_) {
+          not_empty_.wait(lock);
+        }
+        if (tasks_.empty()) {
+          return;
+        }
+        task = tasks_.front();
+        tasks_.pop_front();
+      }
+      not_full_.notify_one();
+
+      Result* result = new Result;
+      result->status = task->status;
+      result->emd_cost = 0;
+      result->amp_sum = 0.0;
+      result->final_lambda = 0.0;
+      if (task->status == EMDFlowServer::kOk) {
+        const EMDFlowInput& problem = task->problem;
+        EMDFlowSolver* solver = server_->get_solver(worker, problem.r,
+            problem.c, get_type(problem));
+        long long num_builds = solver->num_network_builds;
+        long long num_reuses = solver->num_network_reuses;
+        const EMDFlowServerOptions& options = server_->options_;
+        EMDFlowServer::Worker& w = server_->workers_[worker];
+        try {
+          solver->solve(problem.a, problem.k, problem.emd_bound_low,
+              problem.emd_bound_high, options.lambda_high,
+              options.lambda_eps, &(result->support), &(result->emd_cost),
+              &(result->amp_sum), &(result->final_lambda), NULL, false);
+          w.num_network_builds += solver->num_network_builds - num_builds;
+          w.num_network_reuses += solver->num_network_reuses - num_reuses;
+        } catch (const bad_alloc&) {
+          // the networks of the solver may be incomplete
+          server_->remove_solver(worker, solver);
+          result->status = EMDFlowServer::kOutOfMemory;
+          result->support.clear();
+          result->emd_cost = 0;
+          result->amp_sum = 0.0;
+          result->final_lambda = 0.0;
+        }
+      }
+      size_t index = task->index;
+      delete task;
+      finish(index, result);
+    }
+  }
+
+  void finish(size_t index, Result* result) {
+    lock_guard<mutex> lock(output_lock_);
+    pending_[index] = result;
+    bool written = false;
+    map<size_t, Result*>::iterator it;
+    while ((it = pending_.find(next_result_)) != pending_.end()) {
+      Result* next = it->second;
+      write_result_frame(out_, next->status, next->support, next->emd_cost,
+          next->amp_sum, next->final_lambda);
+      ++server_->num_problems;
+      if (next->status == EMDFlowServer::kInvalidProblem) {
+        ++server_->num_invalid_problems;
+      }
+      delete next;
+      pending_.erase(it);
+      ++next_result_;
+      written = true;
+    }
+    if (written) {
+      fflush(out_);
+    }
+  }
+};
+
+EMDFlowServer::EMDFlowServer(const EMDFlowServerOptions& options)
+    : num_problems(0), num_invalid_problems(0), num_network_builds(0),
+    num_network_reuses(0), options_(options) {
+  workers_.resize(max(options_.num_threads, 1));
+  for (size_t ii = 0; ii < workers_.size(); ++ii) {
+    workers_[ii].num_uses = 0;
+    workers_[ii].num_network_builds = 0;
+    workers_[ii].num_network_reuses = 0;
+  }
+}
+
+EMDFlowServer::~EMDFlowServer() {
+  for (size_t ii = 0; ii < workers_.size(); ++ii) {
+    for (size_t jj = 0; jj < workers_[ii].pool.size(); ++jj) {
+      delete workers_[ii].pool[jj].solver;
+    }
+  }
+}
+
+// Only called by the thread of the worker.
+EMDFlowSolver* EMDFlowServer::get_solver(int worker, int r, int c,
+    EMDFlowNetworkFactory::EMDFlowNetworkType alg_type) {
+  Worker& w = workers_[worker];
+  ++w.num_uses;
+  for (size_t ii = 0; ii < w.pool.size(); ++ii) {
+    PooledSolver& pooled = w.pool[ii];
+    if (pooled.r == r && pooled.c == c && pooled.alg_type == alg_type) {
+      pooled.last_use = w.num_uses;
+      return pooled.solver;
+    }
+  }
+
+  if (static_cast<int>(w.pool.size()) >= kMaxPooledSolvers) {
+    size_t oldest = 0;
+    for (size_t ii = 1; ii < w.pool.size(); ++ii) {
+      if (w.pool[ii].last_use < w.pool[oldest].last_use) {
+        oldest = ii;
+      }
+    }
+    delete w.pool[oldest].solver;
+    w.pool.erase(w.pool.begin() + oldest);
+  }
+
+  PooledSolver pooled;
+  pooled.r = r;
+  pooled.c = c;
+  pooled.alg_type = alg_type;
+  pooled.last_use = w.num_uses;
+  pooled.solver = new EMDFlowSolver(alg_type, options_.integer_costs, 1);
+  pooled.solver->set_secant_search(options_.secant_search);
+  pooled.solver->set_dynamic_program(options_.dynamic_program);
+  pooled.solver->set_candidate_pruning(options_.num_candidates,
+      options_.verify_candidates);
+  pooled.solver->set_coarse_to_fine(options_.coarse_factor);
+  pooled.solver->set_column_blocks(options_.num_column_blocks);
+  w.pool.push_back(pooled);
+  return pooled.solver;
+}
+
+// Only called by the thread of the worker.
+void EMDFlowServer::remove_solver(int worker, EMDFlowSolver* solver) {
+  Worker& w = workers_[worker];
+  for (size_t ii = 0; ii < w.pool.size(); ++ii) {
+    if (w.pool[ii].solver == solver) {
+      delete solver;
+      w.pool.erase(w.pool.begin() + ii);
+      return;
+    }
+  }
+}
+
+bool EMDFlowServer::serve(FILE* in, FILE* out, string* error) {
+  EMDFlowServerStream stream(this, out);
+  bool ok = stream.run(in, error);
+  num_network_builds = 0;
+  num_network_reuses = 0;
+  for (size_t ii = 0; ii < workers_.size(); ++ii) {
+    num_network_builds += workers_[ii].num_network_builds;
+    num_network_reuses += workers_[ii].num_network_reuses;
+  }
+  return ok;
+}
+
+bool EMDFlowServer::serve_socket(const string& path, string* error) {
+  // a client that closes its connection early must not stop the server
+  signal(SIGPIPE, SIG_IGN);
+
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    *error = "Socket path " + path + " is too long.";
+    return false;
+  }
+  strcpy(address.sun_path, path.c_str());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    *error = string("Cannot create socket: ") + strerror(errno);
+    return false;
+  }
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+      || listen(fd, 16) != 0) {
+    *error = "Cannot listen on " + path + ": " + strerror(errno);
+    close(fd);
+    return false;
+  }
+
+  for (;;) {
+    int connection = accept(fd, NULL, NULL);
+    if (connection < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      *error = string("accept failed: ") + strerror(errno);
+      close(fd);
+      return false;
+    }
+    FILE* in = fdopen(connection, "rb");
+    FILE* out = fdopen(dup(connection), "wb");
+    if (in == NULL || out == NULL) {
+      if (in != NULL) {
+        fclose(in);
+      } else {
+        close(connection);
+      }
+      if (out != NULL) {
+        fclose(out);
+      }
+      continue;
+    }
+    // a malformed frame only ends its connection
+    string stream_error;
+    serve(in, out, &stream_error);
+    fclose(out);
+    fclose(in);
+  }
+}
@@ -0,0 +1,105 @@
+#ifndef __EMD_FLOW_SERVER_H__
+#define __EMD_FLOW_SERVER_H__
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "emd_flow.h"
+#include "emd_flow_network_factory.h"
+
+// Settings of the solvers of an EMDFlowServer, see the corresponding
+// EMDFlowSolver methods.
+struct EMDFlowServerOptions {
+  EMDFlowNetworkFactory::EMDFlowNetworkType alg_type;
+  bool integer_costs;
+  double lambda_high;
+  double lambda_eps;
+  bool secant_search;
+  bool dynamic_program;
+  int num_candidates;
+  bool verify_candidates;
+  int coarse_factor;
+  int num_column_blocks;
+  // number of worker threads (every solver uses one thread)
+  int num_threads;
+};
+
+// Long-running solver for streams of problems, e.g., a batch job that
+// would otherwise start the emd_flow binary for every problem. A stream is
+// a sequence of problems in the binary format (see read_binary_frame in
+// emd_flow_io.h), and the server writes one result frame (see
+// write_result_frame) per problem in the order of the problems. Clients can
+// send many problems before reading the results.
+// A reader thread parses the next problems while the workers solve the
+// current ones. Every worker keeps up to kMaxPooledSolvers solvers for
+// different (r, c, algorithm), so the networks of a problem are reused by
+// the next problem of the same size and algorithm on the same worker (see
+// EMDFlowSolver). The solvers stay alive between streams.
+class EMDFlowServer {
+ public:
+  static const int kMaxPooledSolvers = 4;
+
+  // status of a result frame
+  enum Status {
+    kOk = 0,
+    // the problem was read, but its parameters are invalid (e.g., k > r)
+    kInvalidProblem = 1,
+    // the problem could not be read (including frames whose amplitudes
+    // cannot be allocated), the server stops reading the stream
+    kMalformedFrame = 2,
+    // the solver ran out of memory, the server continues with the next
+    // problem
+    kOutOfMemory = 3
+  };
+
+  explicit EMDFlowServer(const EMDFlowServerOptions& options);
+  ~EMDFlowServer();
+
+  // Solves the problems of in until the end of the input and writes the
+  // results to out. Returns false if the stream contained a malformed
+  // frame (error is then set).
+  bool serve(FILE* in, FILE* out, std::string* error);
+
+  // Accepts connections on a Unix domain socket at path (replacing an
+  // existing file) and serves them one after the other with serve. Returns
+  // false and sets error if the socket cannot be created or accept fails.
+  bool serve_socket(const std::string& path, std::string* error);
+
+  long long num_problems;
+  long long num_invalid_problems;
+  long long num_network_builds;
+  long long num_network_reuses;
+
+ private:
+  struct PooledSolver {
+    int r;
+    int c;
+    EMDFlowNetworkFactory::EMDFlowNetworkType alg_type;
+    EMDFlowSolver* solver;
+    // value of the worker's counter at the last use (for LRU eviction)
+    long long last_use;
+  };
+
+  struct Worker {
+    std::vector<PooledSolver> pool;
+    long long num_uses;
+    long long num_network_builds;
+    long long num_network_reuses;
+  };
+
+  EMDFlowServerOptions options_;
+  std::vector<Worker> workers_;
+
+  EMDFlowSolver* get_solver(int worker, int r, int c,
+      EMDFlowNetworkFactory::EMDFlowNetworkType alg_type);
+  // Deletes a solver of the pool of worker, e.g., after a failed solve.
+  void remove_solver(int worker, EMDFlowSolver* solver);
+
+  friend class EMDFlowServerStream;
+
+  EMDFlowServer(const EMDFlowServer&);
+  EMDFlowServer& operator=(const EMDFlowServer&);
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "emd_flow_stats.h"
+
+#include <algorithm>
+
+using namespace std;
+
+EMDFlowNetworkStats::EMDFlowNetworkStats()
+    : num_dijkstra_runs(0), num_settled_nodes(0), num_edge_scans(0),
+    num_relaxations(0), num_heap_pushes(0), num_heap_pops(0),
+    num_heap_decrease_keys(0), max_heap_size(0), num_augmenting_paths(0) { }
+
+void EMDFlowNetworkStats::add(const EMDFlowNetworkStats& other) {
+  add_difference(other, EMDFlowNetworkStats());
+}
+
+void EMDFlowNetworkStats::add_difference(const EMDFlowNetworkStats& after,
+    const EMDFlowNetworkStats& before) {
+  num_dijkstra_runs += after.num_dijkstra_runs - before.num_dijkstra_runs;
+  num_settled_nodes += after.num_settled_nodes - before.num_settled_nodes;
+  num_edge_scans += after.num_edge_scans - before.num_edge_scans;
+  num_relaxations += after.num_relaxations - before.num_relaxations;
+  num_heap_pushes += after.num_heap_pushes - before.num_heap_pushes;
+  num_heap_pops += after.num_heap_pops - before.num_heap_pops;
+  num_heap_decrease_keys += after.num_heap_decrease_keys
+      - before.num_heap_decrease_keys;
+  max_heap_size = max(max_heap_size, after.max_heap_size);
+  num_augmenting_paths += after.num_augmenting_paths
+      - before.num_augmenting_paths;
+}
+
+EMDFlowStats::EMDFlowStats() : reused_networks(false),
+    num_lambda_evaluations(0) { }
+
+namespace {
+
+void write_phase_json(FILE* f, const char* name, const EMDFlowPhaseTime& t) {
+  fprintf(f, "\"%s\": {\"wall_time\": %.9g, \"cpu_time\": %.9g}", name,
+      t.wall_time, t.cpu_time);
+}
+
+}  // namespace
+
+void write_stats_json(FILE* f, const EMDFlowStats& stats) {
+  fprintf(f, "{\n  ");
+  write_phase_json(f, "construction", stats.construction);
+  fprintf(f, ",\n  ");
+  write_phase_json(f, "search", stats.search);
+  fprintf(f, ",\n  ");
+  write_phase_json(f, "total", stats.total);
+  fprintf(f, ",\n  \"reused_networks\": %s,\n"
+      "  \"num_lambda_evaluations\": %d,\n  \"trajectory\": [",
+      stats.reused_networks ? "true" : "false",
+      stats.num_lambda_evaluations);
+  for (size_t ii = 0; ii < stats.trajectory.size(); ++ii) {
+    const EMDFlowLambdaRun& run = stats.trajectory[ii];
+    fprintf(f, "%s\n    {\"lambda\": %.17g, \"emd_cost\": %d, "
+        "\"amp_sum\": %.17g, ", (ii == 0) ? "" : ",", run.lambda,
+        run.emd_cost, run.amp_sum);
+    write_phase_json(f, "run_flow", run.run_flow);
+    fprintf(f, ", ");
+    write_phase_json(f, "extraction", run.extraction);
+    fprintf(f, "}");
+  }
+  const EMDFlowNetworkStats& network = stats.network;
+  fprintf(f, "%s],\n  \"network\": {\n"
+      "    \"num_dijkstra_runs\": %lld,\n"
+      "    \"num_settled_nodes\": %lld,\n"
+      "    \"num_edge_scans\": %lld,\n"
+      "    \"num_relaxations\": %lld,\n"
+      "    \"num_heap_pushes\": %lld,\n"
+      "    \"num_heap_pops\": %lld,\n"
+      "    \"num_heap_decrease_keys\": %lld,\n"
+      "    \"max_heap_size\": %lld,\n"
+      "    \"num_augmenting_paths\": %lld\n  }\n}\n",
+      stats.trajectory.empty() ? "" : "\n  ", network.num_dijkstra_runs,
+      network.num_settled_nodes, network.num_edge_scans,
+      network.num_relaxations, network.num_heap_pushes, network.num_heap_pops,
+      network.num_heap_decrease_keys, network.max_heap_size,
+      network.num_augmenting_paths);
+}
@@ -0,0 +1,121 @@
+#ifndef __EMD_FLOW_STATS_H__
+#define __EMD_FLOW_STATS_H__
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+// Statistics are collected unless the code is compiled with
+// -DEMD_FLOW_STATS=0. The collection is guarded by if (EMD_FLOW_STATS), so
+// it is removed by the compiler then. This includes the counters of the
+// Dijkstra and reoptimization loops and of the priority queues, which also
+// stay zero in get_performance_diagnostics. Only the phase times of
+// EMDFlowStats and the counters that change once per run or path (e.g.,
+// the number of Dijkstra runs) are kept.
+#ifndef EMD_FLOW_STATS
+#define EMD_FLOW_STATS 1
+#endif
+
+// Counters of a network since it was built (see
+// EMDFlowNetwork::get_statistics). Networks without Dijkstra searches leave
+// them zero.
+struct EMDFlowNetworkStats {
+  long long num_dijkstra_runs;
+  long long num_settled_nodes;
+  // edges looked at by the searches
+  long long num_edge_scans;
+  // edges that decreased the distance of their head
+  long long num_relaxations;
+  long long num_heap_pushes;
+  long long num_heap_pops;
+  long long num_heap_decrease_keys;
+  // largest number of entries in the heap during a search
+  long long max_heap_size;
+  long long num_augmenting_paths;
+
+  EMDFlowNetworkStats();
+  // Adds the counters of other (the maximum for max_heap_size).
+  void add(const EMDFlowNetworkStats& other);
+  // Adds the counters of after - before (the maximum for max_heap_size).
+  void add_difference(const EMDFlowNetworkStats& after,
+      const EMDFlowNetworkStats& before);
+};
+
+// in seconds
+struct EMDFlowPhaseTime {
+  double wall_time;
+  double cpu_time;
+
+  EMDFlowPhaseTime() : wall_time(0.0), cpu_time(0.0) { }
+};
+
+// One run of a network in the lambda search.
+struct EMDFlowLambdaRun {
+  double lambda;
+  int emd_cost;
+  double amp_sum;
+  // CPU times of the thread that ran the network
+  EMDFlowPhaseTime run_flow;
+  // get_EMD_used, get_supported_amplitude_sum and get_support
+  EMDFlowPhaseTime extraction;
+};
+
+// Statistics of a call of EMDFlowSolver::solve (or emd_flow). The CPU times
+// of the phases are the CPU times of the process, so they include all
+// threads.
+struct EMDFlowStats {
+  // building or updating the networks, including the coarse problems of
+  // EMDFlowSolver::set_coarse_to_fine
+  EMDFlowPhaseTime construction;
+  // the lambda search, including all runs
+  EMDFlowPhaseTime search;
+  EMDFlowPhaseTime total;
+  bool reused_networks;
+  int num_lambda_evaluations;
+  // all runs in the order of the search (the runs of a parallel round in the
+  // order of their networks)
+  std::vector<EMDFlowLambdaRun> trajectory;
+  // sum over all networks used by the search
+  EMDFlowNetworkStats network;
+
+  EMDFlowStats();
+};
+
+// Wall-clock and CPU time since construction. With thread_cpu_time the CPU
+// time of the calling thread, otherwise the CPU time of the process. The
+// timer always reads the clocks (the verbose output of the solver uses the
+// phase times), only the timers per run are omitted without
+// EMD_FLOW_STATS.
+class EMDFlowTimer {
+ public:
+  explicit EMDFlowTimer(bool thread_cpu_time)
+      : clock_id_(thread_cpu_time ? CLOCK_THREAD_CPUTIME_ID
+          : CLOCK_PROCESS_CPUTIME_ID),
+      wall_begin_(std::chrono::steady_clock::now()),
+      cpu_begin_(cpu_time()) { }
+
+  EMDFlowPhaseTime elapsed() const {
+    EMDFlowPhaseTime time;
+    time.wall_time = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - wall_begin_).count();
+    time.cpu_time = cpu_time() - cpu_begin_;
+    return time;
+  }
+
+ private:
+  clockid_t clock_id_;
+  std::chrono::steady_clock::time_point wall_begin_;
+  double cpu_begin_;
+
+  double cpu_time() const {
+    timespec t;
+    clock_gettime(clock_id_, &t);
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+  }
+};
+
+// Writes the statistics as a JSON object.
+void write_stats_json(FILE* f, const EMDFlowStats& stats);
+
+#endif
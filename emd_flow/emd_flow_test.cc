@@ -0,0 +1,158 @@
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "emd_flow.h"
+#include "emd_flow_network_factory.h"
+
+using namespace std;
+
+// Checks of EMDFlowSolver that compare the search variants with each other.
+// Run with "make test". Returns 1 if a check fails.
+
+namespace {
+
+const double kTolerance = 1e-6;
+
+void random_amplitudes(int r, int c, bool signed_amplitudes,
+    vector<vector<double> >* a) {
+  a->assign(r, vector<double>(c));
+  for (int row = 0; row < r; ++row) {
+    for (int col = 0; col < c; ++col) {
+      double value = static_cast<double>(rand() % 2000) / 100.0;
+      if (signed_amplitudes && rand() % 2 == 0) {
+        value = -value;
+      }
+      (*a)[row][col] = value;
+    }
+  }
+}
+
+struct Solution {
+  vector<vector<bool> > support;
+  int emd_cost;
+  double amp_sum;
+  double final_lambda;
+};
+
+void solve(const EMDFlowAmplitudes& a, int k, int emd_bound,
+    bool secant_search, Solution* solution) {
+  EMDFlowSolver solver(EMDFlowNetworkFactory::kShortestAugmentingPath, false,
+      1);
+  solver.set_secant_search(secant_search);
+  solver.solve(a, k, emd_bound, emd_bound, 0.1, 0.0001,
+      &(solution->support), &(solution->emd_cost), &(solution->amp_sum),
+      &(solution->final_lambda), NULL, false);
+}
+
+double support_amp_sum(const vector<vector<double> >& a,
+    const vector<vector<bool> >& support) {
+  double sum = 0.0;
+  for (size_t row = 0; row < a.size(); ++row) {
+    for (size_t col = 0; col < a[row].size(); ++col) {
+      if (support[row][col]) {
+        sum += abs(a[row][col]);
+      }
+    }
+  }
+  return sum;
+}
+
+// The secant search on signed amplitudes has to find the solution for the
+// absolute values, which is at least as good as the bisection.
+bool test_secant_signed_amplitudes() {
+  const int kNumProblems = 300;
+  srand(21);
+  for (int problem = 0; problem < kNumProblems; ++problem) {
+    int r = 2 + rand() % 8;
+    int c = 2 + rand() % 10;
+    int k = 1 + rand() % r;
+    int emd_bound = rand() % (r * c / 2 + 1);
+    vector<vector<double> > a;
+    random_amplitudes(r, c, true, &a);
+    vector<vector<double> > abs_a(a);
+    for (int row = 0; row < r; ++row) {
+      for (int col = 0; col < c; ++col) {
+        abs_a[row][col] = abs(a[row][col]);
+      }
+    }
+
+    Solution secant;
+    Solution abs_secant;
+    Solution bisection;
+    solve(a, k, emd_bound, true, &secant);
+    solve(abs_a, k, emd_bound, true, &abs_secant);
+    solve(a, k, emd_bound, false, &bisection);
+
+    bool ok = secant.emd_cost <= emd_bound
+        && secant.emd_cost == abs_secant.emd_cost
+        && abs(secant.amp_sum - abs_secant.amp_sum) < kTolerance
+        && abs(secant.amp_sum - support_amp_sum(a, secant.support))
+            < kTolerance
+        && secant.amp_sum >= bisection.amp_sum - kTolerance;
+    if (!ok) {
+      fprintf(stderr, "test_secant_signed_amplitudes: problem %d (r = %d, "
+          "c = %d, k = %d, EMD bound %d): secant EMD %d amp sum %f, secant "
+          "on absolute values EMD %d amp sum %f, bisection EMD %d amp sum "
+          "%f\n", problem, r, c, k, emd_bound, secant.emd_cost,
+          secant.amp_sum, abs_secant.emd_cost, abs_secant.amp_sum,
+          bisection.emd_cost, bisection.amp_sum);
+      return false;
+    }
+  }
+  return true;
+}
+
+// A column-major strided view has to give the same solution as the matrix
+// of rows it was copied from.
+bool test_strided_amplitudes() {
+  const int kNumProblems = 100;
+  srand(22);
+  for (int problem = 0; problem < kNumProblems; ++problem) {
+    int r = 2 + rand() % 8;
+    int c = 2 + rand() % 10;
+    int k = 1 + rand() % r;
+    int emd_bound = rand() % (r * c / 2 + 1);
+    vector<vector<double> > a;
+    random_amplitudes(r, c, true, &a);
+    vector<double> column_major(r * c);
+    for (int row = 0; row < r; ++row) {
+      for (int col = 0; col < c; ++col) {
+        column_major[row + col * r] = a[row][col];
+      }
+    }
+    EMDFlowAmplitudes view(&(column_major[0]), r, c, 1, r);
+
+    Solution rows;
+    Solution strided;
+    solve(a, k, emd_bound, true, &rows);
+    solve(view, k, emd_bound, true, &strided);
+
+    bool ok = rows.support == strided.support
+        && rows.emd_cost == strided.emd_cost
+        && abs(rows.amp_sum - strided.amp_sum) < kTolerance;
+    if (!ok) {
+      fprintf(stderr, "test_strided_amplitudes: problem %d (r = %d, c = %d, "
+          "k = %d, EMD bound %d): rows EMD %d amp sum %f, strided EMD %d amp "
+          "sum %f\n", problem, r, c, k, emd_bound, rows.emd_cost,
+          rows.amp_sum, strided.emd_cost, strided.amp_sum);
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  bool ok = true;
+  ok = test_secant_signed_amplitudes() && ok;
+  ok = test_strided_amplitudes() && ok;
+  if (!ok) {
+    fprintf(stderr, "FAILED\n");
+    return 1;
+  }
+  fprintf(stderr, "PASSED\n");
+  return 0;
+}
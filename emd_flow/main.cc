@@ -4,6 +4,8 @@
 #include <boost/program_options.hpp>
 
 #include "emd_flow.h"
+#include "emd_flow_io.h"
+#include "emd_flow_server.h"
 #include "emd_flow_network_factory.h"
 
 using namespace std;
@@ -28,39 +30,151 @@ void output_function(const char* s) {
 int main(int argc, char** argv)
 {
   string alg_name;
+  int num_threads = 1;
+  int num_candidates = 0;
+  int coarse_factor = 0;
+  int num_column_blocks = 0;
+  string support_format_name;
 
   po::options_description desc("Allowed options");
   desc.add_options()
       ("matrix_output", po::value<string>(), "File for binary output matrix")
+      ("support_format", po::value<string>(&support_format_name)->default_value(
+          "text"), "Format of the output matrix: text, bits (packed, "
+          "row-major) or sparse (0-based \"row column\" lines)")
+      ("input", po::value<string>(), "Read the problem from this file "
+          "instead of stdin")
+      ("binary_input", po::value<string>(), "Read the problem from this file "
+          "in the binary format (see emd_flow_io.h)")
+      ("write_binary_input", po::value<string>(), "Write the problem to this "
+          "file in the binary format and exit")
       ("square_amplitudes", "Square all input amplitudes")
       ("algorithm", po::value<string>(&alg_name)->default_value(
           "shortest-augmenting-path"), "Min-cost max-flow algorithm")
       ("print_support", po::value<string>(), "Print support to stderr")
+      ("stats_json", po::value<string>(), "Write the statistics of the "
+          "solver (phase times, lambda trajectory, Dijkstra counters) to this "
+          "file as JSON (see emd_flow_stats.h)")
+      ("integer_costs", "Quantize amplitudes and lambda to 64-bit integer "
+          "costs")
+      ("sparsity_sweep", "Solve for all sparsities 1, ..., k and print "
+          "k, EMD, amp sum and lambda for each")
+      ("frontier", "Compute all breakpoints of the EMD as a function of "
+          "lambda and print lambda range, EMD and amp sum for each")
+      ("num_threads", po::value<int>(&num_threads)->default_value(1),
+          "Number of lambda values evaluated in parallel")
+      ("secant_search", "Search lambda with secant steps instead of a "
+          "bisection")
+      ("no_dynamic_program", "Use the given algorithm also for k <= 2 "
+          "instead of the dynamic program")
+      ("candidates", po::value<int>(&num_candidates)->default_value(0),
+          "Build the SAP network only on the largest entries of every "
+          "column (0: all entries)")
+      ("heuristic_candidates", "Do not verify the pruned entries")
+      ("coarse_to_fine", po::value<int>(&coarse_factor)->default_value(0),
+          "Solve a problem with this many times fewer rows first and "
+          "build the network around its solution (0: off)")
+      ("column_blocks", po::value<int>(&num_column_blocks)->default_value(0),
+          "Split the columns into this many blocks solved in parallel "
+          "(0: off)")
+      ("server", "Solve a stream of problems in the binary format from stdin "
+          "and write the results to stdout (see emd_flow_server.h)")
+      ("socket", po::value<string>(), "With --server, accept streams on a "
+          "Unix domain socket at this path instead")
       ("emd_interval", po::value<string>(), "Read both lower and upper EMD "
           "bound from stdin");
   po::variables_map vm;
   po::store(po::parse_command_line(argc, argv, desc), vm);
   po::notify(vm); 
 
-  int emd_bound_low = 0;
-  int emd_bound_high = 0;
+  SupportFormat support_format = parse_support_format(support_format_name);
+  if (support_format == kSupportUnknown) {
+    fprintf(stderr, "Unknown support format \"%s\", exiting.\n",
+        support_format_name.c_str());
+    return 0;
+  }
+
+  if (vm.count("server")) {
+    EMDFlowServerOptions options;
+    options.alg_type = EMDFlowNetworkFactory::parse_type(alg_name);
+    if (options.alg_type == EMDFlowNetworkFactory::kUnknownType) {
+      fprintf(stderr, "Unknown algorithm \"%s\", exiting.\n",
+          alg_name.c_str());
+      return 0;
+    }
+    options.integer_costs = vm.count("integer_costs") > 0;
+    options.lambda_high = 0.1;
+    options.lambda_eps = 0.0001;
+    options.secant_search = vm.count("secant_search") > 0;
+    options.dynamic_program = vm.count("no_dynamic_program") == 0;
+    options.num_candidates = num_candidates;
+    options.verify_candidates = vm.count("heuristic_candidates") == 0;
+    options.coarse_factor = coarse_factor;
+    options.num_column_blocks = num_column_blocks;
+    options.num_threads = num_threads;
+    EMDFlowServer server(options);
+    string error;
+    bool ok = false;
+    if (vm.count("socket")) {
+      ok = server.serve_socket(vm["socket"].as<string>(), &error);
+    } else {
+      ok = server.serve(stdin, stdout, &error);
+    }
+    fprintf(stderr, "Problems: %lld (invalid: %lld)\n"
+        "Network builds: %lld\nNetwork reuses: %lld\n", server.num_problems,
+        server.num_invalid_problems, server.num_network_builds,
+        server.num_network_reuses);
+    if (!ok) {
+      fprintf(stderr, "%s Exiting.\n", error.c_str());
+      return 1;
+    }
+    return 0;
+  }
 
-  scanf("%d %d %d %d", &r, &c, &k, &emd_bound_low);
-  if (vm.count("emd_interval")) {
-    scanf("%d", &emd_bound_high);
+  EMDFlowInput problem;
+  string error;
+  bool read_ok = false;
+  if (vm.count("binary_input")) {
+    read_ok = read_binary_problem(vm["binary_input"].as<string>(), &problem,
+        &error);
+  } else if (vm.count("input")) {
+    string input_file_name = vm["input"].as<string>();
+    FILE* input_file = fopen(input_file_name.c_str(), "r");
+    if (input_file == NULL) {
+      error = "Cannot open " + input_file_name + ".";
+    } else {
+      read_ok = read_text_problem(input_file, vm.count("emd_interval") > 0,
+          &problem, &error);
+      fclose(input_file);
+    }
   } else {
-    emd_bound_high = emd_bound_low;
+    read_ok = read_text_problem(stdin, vm.count("emd_interval") > 0,
+        &problem, &error);
+  }
+  if (!read_ok) {
+    fprintf(stderr, "%s Exiting.\n", error.c_str());
+    return 1;
   }
 
-  a.resize(r);
-  for (int ii = 0; ii < r; ++ii) {
-    a[ii].resize(c);
-    for (int jj = 0; jj < c; ++jj) {
-      scanf("%lg", &(a[ii][jj]));
-      a[ii][jj] = abs(a[ii][jj]);
+  if (vm.count("write_binary_input")) {
+    string output_file_name = vm["write_binary_input"].as<string>();
+    FILE* output_file = fopen(output_file_name.c_str(), "wb");
+    if (output_file == NULL || !write_binary_problem(output_file, problem)) {
+      fprintf(stderr, "Cannot write %s, exiting.\n",
+          output_file_name.c_str());
+      return 1;
     }
+    fclose(output_file);
+    return 0;
   }
 
+  r = problem.r;
+  c = problem.c;
+  k = problem.k;
+  int emd_bound_low = problem.emd_bound_low;
+  int emd_bound_high = problem.emd_bound_high;
+  a.swap(problem.a);
+
   if (vm.count("square_amplitudes")) {
     fprintf(stderr, "Squaring all amplitudes ...\n");
     for (int ii = 0; ii < r; ++ii) {
@@ -78,12 +192,62 @@ int main(int argc, char** argv)
     return 0;
   }
 
-  
+  if (vm.count("sparsity_sweep")) {
+    vector<EMDFlowSweepResult> results;
+    emd_flow_sparsity_sweep(a, k, emd_bound_low, emd_bound_high, 0.1, 0.0001,
+        &results, alg_type, vm.count("integer_costs") > 0, output_function,
+        true);
+    for (size_t ii = 0; ii < results.size(); ++ii) {
+      printf("%lu %d %f %f\n", ii + 1, results[ii].emd_cost,
+          results[ii].amp_sum, results[ii].final_lambda);
+    }
+    return 0;
+  }
+
+  if (vm.count("frontier")) {
+    vector<EMDFlowFrontierPoint> frontier;
+    emd_flow_frontier(a, k, &frontier, alg_type,
+        vm.count("integer_costs") > 0, output_function, true);
+    for (size_t ii = 0; ii < frontier.size(); ++ii) {
+      printf("%f %f %d %f\n", frontier[ii].lambda_low,
+          frontier[ii].lambda_high, frontier[ii].emd_cost,
+          frontier[ii].amp_sum);
+    }
+    size_t index = emd_flow_frontier_lookup(frontier, emd_bound_high, r, c,
+        &result);
+    fprintf(stderr, "EMD budget %d: EMD: %d  amp sum: %f\n", emd_bound_high,
+        frontier[index].emd_cost, frontier[index].amp_sum);
+    return 0;
+  }
+
   int emd_cost = 0;
   double amp_sum = 0.0;
   double final_lambda = 0.0;
-  emd_flow(a, k, emd_bound_low, emd_bound_high, 0.1, 0.0001, &result, &emd_cost,
-      &amp_sum, &final_lambda, alg_type, output_function, true);
+  EMDFlowSolver solver(alg_type, vm.count("integer_costs") > 0, num_threads);
+  solver.set_secant_search(vm.count("secant_search") > 0);
+  solver.set_dynamic_program(vm.count("no_dynamic_program") == 0);
+  solver.set_candidate_pruning(num_candidates,
+      vm.count("heuristic_candidates") == 0);
+  solver.set_coarse_to_fine(coarse_factor);
+  solver.set_column_blocks(num_column_blocks);
+  solver.solve(a, k, emd_bound_low, emd_bound_high, 0.1, 0.0001, &result,
+      &emd_cost, &amp_sum, &final_lambda, output_function, true);
+  fprintf(stderr, "Number of flow runs: %lld\n", solver.num_flow_runs);
+  if (solver.num_coarse_flow_runs > 0) {
+    fprintf(stderr, "Number of coarse flow runs: %lld\n",
+        solver.num_coarse_flow_runs);
+  }
+
+  if (vm.count("stats_json")) {
+    string stats_file_name = vm["stats_json"].as<string>();
+    FILE* stats_file = fopen(stats_file_name.c_str(), "w");
+    if (stats_file == NULL) {
+      fprintf(stderr, "Cannot write %s, exiting.\n", stats_file_name.c_str());
+      return 1;
+    }
+    write_stats_json(stats_file, solver.stats);
+    fclose(stats_file);
+  }
 
   if (vm.count("print_support")) {
     for (int jj = 0; jj < c; ++jj) {
@@ -100,17 +264,9 @@ int main(int argc, char** argv)
 
   if (vm.count("matrix_output")) {
     string output_file_name = vm["matrix_output"].as<string>();
-    FILE* output_file = fopen(output_file_name.c_str(), "w");
-    for (int ii = 0; ii < r; ++ii) {
-      for (int jj = 0; jj < c; ++jj) {
-        if (result[ii][jj]) {
-          fprintf(output_file, "1 ");
-        } else {
-          fprintf(output_file, "0 ");
-        }
-      }
-      fprintf(output_file, "\n");
-    }
+    FILE* output_file = fopen(output_file_name.c_str(),
+        support_format == kSupportBits ? "wb" : "w");
+    write_support(output_file, result, support_format);
     fclose(output_file);
   }
 
@@ -6,6 +6,7 @@
 #include <cmath>
 #include <vector>
 #include <string>
+#include <stdint.h>
 
 bool get_double(const mxArray* raw_data, double* data) {
   int numdims = mxGetNumberOfDimensions(raw_data);
@@ -43,6 +44,32 @@ bool get_bool(const mxArray* raw_data, bool* data) {
   return true;
 }
 
+bool get_string(const mxArray* raw_data, std::string* data) {
+  if (!mxIsChar(raw_data)) {
+    return false;
+  }
+  char* tmp = mxArrayToString(raw_data);
+  if (tmp == NULL) {
+    return false;
+  }
+  *data = tmp;
+  mxFree(tmp);
+  return true;
+}
+
+bool get_uint64(const mxArray* raw_data, uint64_t* data) {
+  int numdims = mxGetNumberOfDimensions(raw_data);
+  const mwSize* dims = mxGetDimensions(raw_data);
+  if (numdims != 2 || dims[0] != 1 || dims[1] != 1) {
+    return false;
+  }
+  if (!mxIsClass(raw_data, "uint64")) {
+    return false;
+  }
+  *data = static_cast<uint64_t*>(mxGetData(raw_data))[0];
+  return true;
+}
+
 bool get_double_row_vector(const mxArray* raw_data,
     std::vector<double>* data) {
   int numdims = mxGetNumberOfDimensions(raw_data);
@@ -80,30 +107,22 @@ bool get_double_interval_as_ints(const mxArray* raw_data, int* left,
   return true;
 }
 
-bool get_double_matrix(const mxArray* raw_data,
-    std::vector<std::vector<double> >* data) {
+// Returns the column-major data of a real double matrix in place, entry
+// (row, col) is (*data)[row + col * num_rows]. The data is owned by the
+// array and is only valid while the array is.
+bool get_double_matrix(const mxArray* raw_data, const double** data,
+    size_t* num_rows, size_t* num_columns) {
   int numdims = mxGetNumberOfDimensions(raw_data);
   const mwSize* dims = mxGetDimensions(raw_data);
   if (numdims != 2) {
     return false;
   }
-  if (!mxIsClass(raw_data, "double")) {
+  if (!mxIsClass(raw_data, "double") || mxIsComplex(raw_data)) {
     return false;
   }
-  size_t r = dims[0];
-  size_t c = dims[1];
-  double* data_linear = static_cast<double*>(mxGetData(raw_data));
-  if (data->size() != r) {
-    data->resize(r);
-  }
-  for (size_t ir = 0; ir < r; ++ir) {
-    if ((*data)[ir].size() != c) {
-      (*data)[ir].resize(c);
-    }
-    for (size_t ic = 0; ic < c; ++ic) {
-      (*data)[ir][ic] = data_linear[ir + ic * r];
-    }
-  }
+  *num_rows = dims[0];
+  *num_columns = dims[1];
+  *data = static_cast<const double*>(mxGetData(raw_data));
   return true;
 }
 
@@ -168,6 +187,25 @@ void set_double(mxArray** raw_data, double data) {
   *(static_cast<double*>(mxGetData(*raw_data))) = data;
 }
 
+void set_uint64(mxArray** raw_data, uint64_t data) {
+  *raw_data = mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL);
+  *(static_cast<uint64_t*>(mxGetData(*raw_data))) = data;
+}
+
+void set_logical_matrix(mxArray** raw_data,
+    const std::vector<std::vector<bool> >& data) {
+  size_t r = data.size();
+  size_t c = data[0].size();
+  *raw_data = mxCreateLogicalMatrix(r, c);
+  mxLogical* result_linear = mxGetLogicals(*raw_data);
+
+  for (size_t ir = 0; ir < r; ++ir) {
+    for (size_t ic = 0; ic < c; ++ic) {
+      result_linear[ir + ic * r] = data[ir][ic];
+    }
+  }
+}
+
 void set_double_matrix(mxArray** raw_data,
     const std::vector<std::vector<double> >& data) {
   int numdims = 2;
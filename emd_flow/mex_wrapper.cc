@@ -2,7 +2,9 @@
 #include <string>
 #include <set>
 
+#include <limits.h>
 #include <math.h>
+#include <stdint.h>
 #include <matrix.h>
 #include <mex.h>
 
@@ -12,34 +14,213 @@
 
 using namespace std;
 
+// Usage:
+//   [support, emd_cost, amp_sum, final_lambda] = emd_flow(a, k, budget)
+//   [support, emd_cost, amp_sum, final_lambda] = emd_flow(a, k, budget,
+//       options)
+// solves a single problem (budget is a scalar or an interval [low, high]).
+// For repeated calls on amplitudes of the same size (e.g., in the
+// iterations of a recovery algorithm), a solver handle keeps the networks,
+// their flow and potentials and the final lambda between calls (with warm
+// starts, see EMDFlowSolver::set_warm_start):
+//   handle = emd_flow('create')
+//   handle = emd_flow('create', options)
+//   [support, emd_cost, amp_sum, final_lambda] = emd_flow('solve', handle,
+//       a, k, budget)
+//   [support, emd_cost, amp_sum] = emd_flow('solve_lambda', handle, a, k,
+//       lambda)
+//   emd_flow('update', handle, options)
+//   emd_flow('destroy', handle)
+// The support is a logical array of the size of a. The options are a
+// struct with the fields verbose, lambda_high, lambda_eps, secant_search,
+// integer_costs, num_threads and algorithm (a name as for the --algorithm
+// option of the emd_flow binary). The last three fix the networks and
+// cannot be changed with 'update'.
+// The amplitudes are read in place from the column-major array, without a
+// copy into an intermediate matrix.
+//
+// Built with -DEMD_FLOW_LAMBDA (make emd_flow_lambda_mexwrapper), this file
+// gives the alias
+//   [support, emd_cost, amp_sum] = emd_flow_lambda(a, k, lambda)
+// for emd_flow('solve_lambda', handle, a, k, lambda) with a default handle
+// that is created on the first call and kept until the MEX file is cleared.
+
+struct MexOptions {
+  bool verbose;
+  double lambda_high;
+  double lambda_eps;
+  bool secant_search;
+  bool integer_costs;
+  int num_threads;
+  EMDFlowNetworkFactory::EMDFlowNetworkType alg_type;
+
+  MexOptions() : verbose(false), lambda_high(1.0), lambda_eps(0.0001),
+      secant_search(false), integer_costs(false), num_threads(1),
+      alg_type(EMDFlowNetworkFactory::kShortestAugmentingPath) { }
+};
+
+struct SolverHandle {
+  MexOptions options;
+  EMDFlowSolver solver;
+  // buffer reused between calls of the same size
+  vector<vector<bool> > result;
+
+  SolverHandle(const MexOptions& opts)
+      : options(opts), solver(opts.alg_type, opts.integer_costs,
+      opts.num_threads) {
+    solver.set_secant_search(options.secant_search);
+  }
+};
+
+// all live handles, so that invalid handles give an error instead of a crash
+static set<SolverHandle*> handles;
+
 void output_function(const char* s) {
   mexPrintf(s);
   mexEvalString("drawnow;");
 }
 
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
-  if (nrhs < 3) {
-    mexErrMsgTxt("At least three input argument required (amplitudes, sparsity,"
-        " EMD budget.");
+void destroy_all_handles() {
+  for (set<SolverHandle*>::iterator it = handles.begin(); it != handles.end();
+      ++it) {
+    delete *it;
   }
-  if (nlhs > 4) {
-    mexErrMsgTxt("Too many output arguments.");
+  handles.clear();
+}
+
+// With create false, only the options that do not change the networks are
+// allowed.
+void parse_options(const mxArray* raw_options, bool create,
+    MexOptions* options) {
+  set<string> known_options;
+  known_options.insert("verbose");
+  known_options.insert("lambda_high");
+  known_options.insert("lambda_eps");
+  known_options.insert("secant_search");
+  known_options.insert("integer_costs");
+  known_options.insert("num_threads");
+  known_options.insert("algorithm");
+  vector<string> fields;
+  if (!get_fields(raw_options, &fields)) {
+    mexErrMsgTxt("Cannot get fields from options argument.");
   }
-  
-  vector<vector<double> > a;
-  if (!get_double_matrix(prhs[0], &a)) {
-    mexErrMsgTxt("Amplitudes need to be a two-dimensional double array.");
+  const size_t tmp_size = 1000;
+  char tmp[tmp_size];
+  for (size_t ii = 0; ii < fields.size(); ++ii) {
+    if (known_options.find(fields[ii]) == known_options.end()) {
+      snprintf(tmp, tmp_size, "Unknown option \"%s\"\n", fields[ii].c_str());
+      mexErrMsgTxt(tmp);
+    }
+    if (!create && (fields[ii] == "integer_costs"
+        || fields[ii] == "num_threads" || fields[ii] == "algorithm")) {
+      snprintf(tmp, tmp_size, "Option \"%s\" can only be set when creating "
+          "the solver.\n", fields[ii].c_str());
+      mexErrMsgTxt(tmp);
+    }
+  }
+
+  if (has_field(raw_options, "verbose")
+      && !get_bool_field(raw_options, "verbose", &(options->verbose))) {
+    mexErrMsgTxt("verbose flag has to be a boolean scalar.");
+  }
+
+  if (has_field(raw_options, "lambda_high")
+      && !get_double_field(raw_options, "lambda_high",
+          &(options->lambda_high))) {
+    mexErrMsgTxt("lambda_high has to be a double scalar.");
+  }
+
+  if (has_field(raw_options, "lambda_eps")
+      && !get_double_field(raw_options, "lambda_eps",
+          &(options->lambda_eps))) {
+    mexErrMsgTxt("lambda_eps has to be a double scalar.");
+  }
+
+  if (has_field(raw_options, "secant_search")
+      && !get_bool_field(raw_options, "secant_search",
+          &(options->secant_search))) {
+    mexErrMsgTxt("secant_search flag has to be a boolean scalar.");
   }
 
+  if (has_field(raw_options, "integer_costs")
+      && !get_bool_field(raw_options, "integer_costs",
+          &(options->integer_costs))) {
+    mexErrMsgTxt("integer_costs flag has to be a boolean scalar.");
+  }
+
+  if (has_field(raw_options, "num_threads")
+      && !get_double_field_as_int(raw_options, "num_threads",
+          &(options->num_threads))) {
+    mexErrMsgTxt("num_threads has to be a double scalar.");
+  }
+
+  if (has_field(raw_options, "algorithm")) {
+    string name;
+    if (!get_string(mxGetField(raw_options, 0, "algorithm"), &name)) {
+      mexErrMsgTxt("algorithm has to be a string.");
+    }
+    options->alg_type = EMDFlowNetworkFactory::parse_type(name);
+    if (options->alg_type == EMDFlowNetworkFactory::kUnknownType) {
+      snprintf(tmp, tmp_size, "Unknown algorithm \"%s\"\n", name.c_str());
+      mexErrMsgTxt(tmp);
+    }
+  }
+}
+
+SolverHandle* get_handle(const mxArray* raw_handle) {
+  uint64_t value = 0;
+  if (!get_uint64(raw_handle, &value)) {
+    mexErrMsgTxt("Solver handle has to be a uint64 scalar.");
+  }
+  SolverHandle* handle = reinterpret_cast<SolverHandle*>(value);
+  if (handles.find(handle) == handles.end()) {
+    mexErrMsgTxt("Invalid solver handle (destroyed or cleared).");
+  }
+  return handle;
+}
+
+SolverHandle* create_handle(const MexOptions& options) {
+  if (handles.empty()) {
+    mexAtExit(destroy_all_handles);
+  }
+  SolverHandle* handle = new SolverHandle(options);
+  handle->solver.set_warm_start(true);
+  handles.insert(handle);
+  return handle;
+}
+
+EMDFlowAmplitudes get_amplitudes(const mxArray* raw_a) {
+  const double* data = NULL;
+  size_t r = 0;
+  size_t c = 0;
+  if (!get_double_matrix(raw_a, &data, &r, &c) || r == 0 || c == 0
+      || r > INT_MAX || c > INT_MAX) {
+    mexErrMsgTxt("Amplitudes need to be a non-empty two-dimensional real "
+        "double array.");
+  }
+  return EMDFlowAmplitudes(data, r, c, 1, r);
+}
+
+int get_sparsity(const mxArray* raw_k, int num_rows) {
   int k = 0;
-  if (!get_double_as_int(prhs[1], &k)) {
+  if (!get_double_as_int(raw_k, &k)) {
     mexErrMsgTxt("Sparsity has to be a double scalar.");
   }
+  if (k < 0 || k > num_rows) {
+    mexErrMsgTxt("Sparsity has to be between 0 and the number of rows.");
+  }
+  return k;
+}
+
+void solve(SolverHandle* handle, const mxArray* raw_a, const mxArray* raw_k,
+    const mxArray* raw_budget, int nlhs, mxArray* plhs[]) {
+  EMDFlowAmplitudes a = get_amplitudes(raw_a);
+  int k = get_sparsity(raw_k, a.num_rows());
 
   int emd_bound_low = 0;
   int emd_bound_high = 0;
-  if (!get_double_as_int(prhs[2], &emd_bound_low)) {
-    if (!get_double_interval_as_ints(prhs[2], &emd_bound_low,
+  if (!get_double_as_int(raw_budget, &emd_bound_low)) {
+    if (!get_double_interval_as_ints(raw_budget, &emd_bound_low,
         &emd_bound_high)) {
       mexErrMsgTxt("EMD budget has to be a double scalar or a double "
           "interval.");
@@ -48,55 +229,48 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     emd_bound_high = emd_bound_low;
   }
 
-  // optional parameters
-  bool verbose = false;
-  double lambda_high = 1.0;
-  double lambda_eps = 0.0001;
-  if (nrhs == 4) {
-    set<string> known_options;
-    known_options.insert("verbose");
-    known_options.insert("lambda_high");
-    known_options.insert("lambda_eps");
-    vector<string> options;
-    if (!get_fields(prhs[3], &options)) {
-      mexErrMsgTxt("Cannot get fields from options argument.");
-    }
-    for (size_t ii = 0; ii < options.size(); ++ii) {
-      if (known_options.find(options[ii]) == known_options.end()) {
-        const size_t tmp_size = 1000;
-        char tmp[tmp_size];
-        snprintf(tmp, tmp_size, "Unknown option \"%s\"\n", options[ii].c_str());
-        mexErrMsgTxt(tmp);
-      }
-    }
+  int emd_cost;
+  double amp_sum;
+  double final_lambda;
+  const MexOptions& options = handle->options;
+  handle->solver.solve(a, k, emd_bound_low, emd_bound_high,
+      options.lambda_high, options.lambda_eps, &(handle->result), &emd_cost,
+      &amp_sum, &final_lambda, output_function, options.verbose);
 
-    if (has_field(prhs[3], "verbose")
-        && !get_bool_field(prhs[3], "verbose", &verbose)) {
-      mexErrMsgTxt("verbose flag has to be a boolean scalar.");
-    }
+  if (nlhs >= 1) {
+    set_logical_matrix(&(plhs[0]), handle->result);
+  }
 
-    if (has_field(prhs[3], "lambda_high")
-        && !get_double_field(prhs[3], "lambda_high", &lambda_high)) {
-      mexErrMsgTxt("lambda_high flag has to be a boolean scalar.");
-    }
+  if (nlhs >= 2) {
+    set_double(&(plhs[1]), emd_cost);
+  }
 
-    if (has_field(prhs[3], "lambda_eps")
-        && !get_double_field(prhs[3], "lambda_eps", &lambda_eps)) {
-      mexErrMsgTxt("lambda_eps flag has to be a boolean scalar.");
-    }
+  if (nlhs >= 3) {
+    set_double(&(plhs[2]), amp_sum);
+  }
+
+  if (nlhs >= 4) {
+    set_double(&(plhs[3]), final_lambda);
+  }
+}
+
+void solve_lambda(SolverHandle* handle, const mxArray* raw_a,
+    const mxArray* raw_k, const mxArray* raw_lambda, int nlhs,
+    mxArray* plhs[]) {
+  EMDFlowAmplitudes a = get_amplitudes(raw_a);
+  int k = get_sparsity(raw_k, a.num_rows());
+  double lambda = 0.0;
+  if (!get_double(raw_lambda, &lambda)) {
+    mexErrMsgTxt("Lambda has to be a double scalar.");
   }
 
-  vector<vector<bool> > result;
   int emd_cost;
   double amp_sum;
-  double final_lambda;
-
-  emd_flow(a, k, emd_bound_low, emd_bound_high, lambda_high, lambda_eps,
-      &result, &emd_cost, &amp_sum, &final_lambda,
-      EMDFlowNetworkFactory::kShortestAugmentingPath, output_function, verbose);
+  handle->solver.solve_lambda(a, k, lambda, &(handle->result),
+      &emd_cost, &amp_sum);
 
   if (nlhs >= 1) {
-    set_double_matrix(&(plhs[0]), result);
+    set_logical_matrix(&(plhs[0]), handle->result);
   }
 
   if (nlhs >= 2) {
@@ -106,18 +280,101 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
   if (nlhs >= 3) {
     set_double(&(plhs[2]), amp_sum);
   }
+}
 
-  if (nlhs >= 4) {
-    set_double(&(plhs[3]), final_lambda);
+#ifdef EMD_FLOW_LAMBDA
+
+// handle of emd_flow_lambda, NULL until the first call
+static SolverHandle* lambda_handle = NULL;
+
+void destroy_lambda_handle() {
+  destroy_all_handles();
+  lambda_handle = NULL;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+  if (nrhs != 3) {
+    mexErrMsgTxt("Three input arguments required (amplitudes, sparsity, "
+        "lambda).");
+  }
+  if (nlhs > 3) {
+    mexErrMsgTxt("Too many output arguments.");
+  }
+  if (lambda_handle == NULL) {
+    lambda_handle = create_handle(MexOptions());
+    mexAtExit(destroy_lambda_handle);
+  }
+  solve_lambda(lambda_handle, prhs[0], prhs[1], prhs[2], nlhs, plhs);
+}
+
+#else
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+  if (nrhs < 1) {
+    mexErrMsgTxt("At least one input argument required.");
   }
 
-  /*
-  mexPrintf("r = %d, c = %d, k = %d, EMD budget = %d\n", r, c, k, emd_budget);
-  for (int ii = 0; ii < r; ++ii) {
-    for (int jj = 0; jj < c; ++jj) {
-      mexPrintf("%lf ", a[ii][jj]);
+  if (!mxIsChar(prhs[0])) {
+    if (nrhs < 3 || nrhs > 4) {
+      mexErrMsgTxt("Three or four input arguments required (amplitudes, "
+          "sparsity, EMD budget, options).");
     }
-    mexPrintf("\n");
+    if (nlhs > 4) {
+      mexErrMsgTxt("Too many output arguments.");
+    }
+    MexOptions options;
+    if (nrhs == 4) {
+      parse_options(prhs[3], true, &options);
+    }
+    SolverHandle handle(options);
+    solve(&handle, prhs[0], prhs[1], prhs[2], nlhs, plhs);
+    return;
+  }
+
+  string command;
+  get_string(prhs[0], &command);
+  if (command == "create") {
+    if (nrhs > 2) {
+      mexErrMsgTxt("Usage: handle = emd_flow('create', options)");
+    }
+    MexOptions options;
+    if (nrhs == 2) {
+      parse_options(prhs[1], true, &options);
+    }
+    SolverHandle* handle = create_handle(options);
+    set_uint64(&(plhs[0]), reinterpret_cast<uint64_t>(handle));
+  } else if (command == "solve") {
+    if (nrhs != 5 || nlhs > 4) {
+      mexErrMsgTxt("Usage: [support, emd_cost, amp_sum, final_lambda] = "
+          "emd_flow('solve', handle, a, k, budget)");
+    }
+    solve(get_handle(prhs[1]), prhs[2], prhs[3], prhs[4], nlhs, plhs);
+  } else if (command == "solve_lambda") {
+    if (nrhs != 5 || nlhs > 3) {
+      mexErrMsgTxt("Usage: [support, emd_cost, amp_sum] = "
+          "emd_flow('solve_lambda', handle, a, k, lambda)");
+    }
+    solve_lambda(get_handle(prhs[1]), prhs[2], prhs[3], prhs[4], nlhs, plhs);
+  } else if (command == "update") {
+    if (nrhs != 3) {
+      mexErrMsgTxt("Usage: emd_flow('update', handle, options)");
+    }
+    SolverHandle* handle = get_handle(prhs[1]);
+    parse_options(prhs[2], false, &(handle->options));
+    handle->solver.set_secant_search(handle->options.secant_search);
+  } else if (command == "destroy") {
+    if (nrhs != 2) {
+      mexErrMsgTxt("Usage: emd_flow('destroy', handle)");
+    }
+    SolverHandle* handle = get_handle(prhs[1]);
+    handles.erase(handle);
+    delete handle;
+  } else {
+    const size_t tmp_size = 1000;
+    char tmp[tmp_size];
+    snprintf(tmp, tmp_size, "Unknown command \"%s\"\n", command.c_str());
+    mexErrMsgTxt(tmp);
   }
-  */
 }
+
+#endif
@@ -0,0 +1,450 @@
+#ifndef __PRIORITY_QUEUES_H__
+#define __PRIORITY_QUEUES_H__
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <cstddef>
+#include <stdint.h>
+
+#include "emd_flow_stats.h"
+
+// Priority queues for the Dijkstra searches of the SAP networks. All queues
+// store nodes 0, ..., num_nodes - 1 with keys of type Key and share the same
+// interface:
+//
+//   resize(num_nodes)  prepares the queue for nodes 0, ..., num_nodes - 1
+//   clear()            removes all nodes
+//   empty()
+//   push(node, key)    inserts the node or decreases its key (the new key
+//                      must not be larger than the current one)
+//   pop(&node, &key)   removes a node with the smallest key
+//
+// The memory used by the queues is kept across clear() calls. The queues
+// count their operations and record their largest size in max_size (only
+// with EMD_FLOW_STATS, see emd_flow_stats.h).
+
+// marks empty slots / links in the indexed queues
+const uint32_t kNoHeapNode = std::numeric_limits<uint32_t>::max();
+
+// Binary heap without decrease-key. A push of a node that is already in the
+// heap inserts a second entry, so pop() can return a node more than once
+// (with the larger keys later). The caller has to skip these entries.
+template <typename KeyType>
+class LazyBinaryHeap {
+ public:
+  typedef KeyType Key;
+
+  LazyBinaryHeap() : num_pushes(0), num_pops(0), num_decrease_keys(0),
+      max_size(0) { }
+
+  void resize(size_t /*num_nodes*/) {
+    heap_.clear();
+  }
+
+  void clear() {
+    heap_.clear();
+  }
+
+  bool empty() const {
+    return heap_.empty();
+  }
+
+  void push(uint32_t node, Key key) {
+    heap_.push_back(std::make_pair(key, node));
+    std::push_heap(heap_.begin(), heap_.end(), std::greater<Entry>());
+    if (EMD_FLOW_STATS) {
+      ++num_pushes;
+      max_size = std::max(max_size, static_cast<long long>(heap_.size()));
+    }
+  }
+
+  void pop(uint32_t* node, Key* key) {
+    std::pop_heap(heap_.begin(), heap_.end(), std::greater<Entry>());
+    *key = heap_.back().first;
+    *node = heap_.back().second;
+    heap_.pop_back();
+    if (EMD_FLOW_STATS) {
+      ++num_pops;
+    }
+  }
+
+  long long num_pushes;
+  long long num_pops;
+  long long num_decrease_keys;
+  long long max_size;
+
+ private:
+  typedef std::pair<Key, uint32_t> Entry;
+  std::vector<Entry> heap_;
+};
+
+
+// D-ary heap with an index from nodes to heap slots, so every node is in the
+// heap at most once and push() of a contained node is a decrease-key.
+template <int D, typename KeyType>
+class IndexedDaryHeap {
+ public:
+  typedef KeyType Key;
+
+  IndexedDaryHeap() : num_pushes(0), num_pops(0), num_decrease_keys(0),
+      max_size(0) { }
+
+  void resize(size_t num_nodes) {
+    heap_.clear();
+    heap_.reserve(num_nodes);
+    position_.assign(num_nodes, kNoHeapNode);
+  }
+
+  void clear() {
+    for (size_t ii = 0; ii < heap_.size(); ++ii) {
+      position_[heap_[ii].node] = kNoHeapNode;
+    }
+    heap_.clear();
+  }
+
+  bool empty() const {
+    return heap_.empty();
+  }
+
+  void push(uint32_t node, Key key) {
+    size_t slot = position_[node];
+    if (slot == kNoHeapNode) {
+      slot = heap_.size();
+      heap_.push_back(Entry(key, node));
+      if (EMD_FLOW_STATS) {
+        ++num_pushes;
+        max_size = std::max(max_size, static_cast<long long>(heap_.size()));
+      }
+    } else {
+      heap_[slot].key = key;
+      if (EMD_FLOW_STATS) {
+        ++num_decrease_keys;
+      }
+    }
+    sift_up(slot);
+  }
+
+  void pop(uint32_t* node, Key* key) {
+    *node = heap_[0].node;
+    *key = heap_[0].key;
+    position_[*node] = kNoHeapNode;
+    Entry last = heap_.back();
+    heap_.pop_back();
+    if (!heap_.empty()) {
+      heap_[0] = last;
+      sift_down(0);
+    }
+    if (EMD_FLOW_STATS) {
+      ++num_pops;
+    }
+  }
+
+  long long num_pushes;
+  long long num_pops;
+  long long num_decrease_keys;
+  long long max_size;
+
+ private:
+  struct Entry {
+    Key key;
+    uint32_t node;
+
+    Entry(Key _key, uint32_t _node) : key(_key), node(_node) { }
+  };
+
+  std::vector<Entry> heap_;
+  std::vector<uint32_t> position_;
+
+  // moves the entry in the given slot towards the root until the heap order
+  // is restored
+  void sift_up(size_t slot) {
+    Entry cur = heap_[slot];
+    while (slot > 0) {
+      size_t parent = (slot - 1) / D;
+      if (heap_[parent].key <= cur.key) {
+        break;
+      }
+      heap_[slot] = heap_[parent];
+      position_[heap_[slot].node] = slot;
+      slot = parent;
+    }
+    heap_[slot] = cur;
+    position_[cur.node] = slot;
+  }
+
+  void sift_down(size_t slot) {
+    Entry cur = heap_[slot];
+    size_t size = heap_.size();
+    while (true) {
+      size_t first_child = D * slot + 1;
+      if (first_child >= size) {
+        break;
+      }
+      size_t last_child = std::min(first_child + D, size);
+      size_t best_child = first_child;
+      for (size_t child = first_child + 1; child < last_child; ++child) {
+        if (heap_[child].key < heap_[best_child].key) {
+          best_child = child;
+        }
+      }
+      if (cur.key <= heap_[best_child].key) {
+        break;
+      }
+      heap_[slot] = heap_[best_child];
+      position_[heap_[slot].node] = slot;
+      slot = best_child;
+    }
+    heap_[slot] = cur;
+    position_[cur.node] = slot;
+  }
+};
+
+
+// Pairing heap (two-pass variant) with decrease-key. The heap nodes are the
+// graph nodes themselves, so no memory is allocated after resize().
+template <typename KeyType>
+class PairingHeap {
+ public:
+  typedef KeyType Key;
+
+  PairingHeap() : num_pushes(0), num_pops(0), num_decrease_keys(0),
+      max_size(0), root_(kNoHeapNode), size_(0) { }
+
+  void resize(size_t num_nodes) {
+    key_.resize(num_nodes);
+    child_.assign(num_nodes, kNoHeapNode);
+    next_.assign(num_nodes, kNoHeapNode);
+    prev_.assign(num_nodes, kNoHeapNode);
+    in_heap_.assign(num_nodes, 0);
+    root_ = kNoHeapNode;
+    size_ = 0;
+  }
+
+  void clear() {
+    if (root_ == kNoHeapNode) {
+      return;
+    }
+    // remove all nodes of the tree
+    std::vector<uint32_t>& stack = roots_;
+    stack.clear();
+    stack.push_back(root_);
+    while (!stack.empty()) {
+      uint32_t cur = stack.back();
+      stack.pop_back();
+      for (uint32_t child = child_[cur]; child != kNoHeapNode;
+          child = next_[child]) {
+        stack.push_back(child);
+      }
+      in_heap_[cur] = 0;
+    }
+    root_ = kNoHeapNode;
+    size_ = 0;
+  }
+
+  bool empty() const {
+    return root_ == kNoHeapNode;
+  }
+
+  void push(uint32_t node, Key key) {
+    key_[node] = key;
+    if (!in_heap_[node]) {
+      in_heap_[node] = 1;
+      child_[node] = kNoHeapNode;
+      next_[node] = kNoHeapNode;
+      prev_[node] = kNoHeapNode;
+      root_ = (root_ == kNoHeapNode) ? node : link(root_, node);
+      if (EMD_FLOW_STATS) {
+        ++num_pushes;
+      }
+      ++size_;
+      if (EMD_FLOW_STATS) {
+        max_size = std::max(max_size, static_cast<long long>(size_));
+      }
+    } else {
+      if (EMD_FLOW_STATS) {
+        ++num_decrease_keys;
+      }
+      if (node == root_) {
+        return;
+      }
+      // cut the subtree of node and meld it with the root
+      uint32_t prev = prev_[node];
+      if (child_[prev] == node) {
+        child_[prev] = next_[node];
+      } else {
+        next_[prev] = next_[node];
+      }
+      if (next_[node] != kNoHeapNode) {
+        prev_[next_[node]] = prev;
+      }
+      next_[node] = kNoHeapNode;
+      prev_[node] = kNoHeapNode;
+      root_ = link(root_, node);
+    }
+  }
+
+  void pop(uint32_t* node, Key* key) {
+    *node = root_;
+    *key = key_[root_];
+    in_heap_[root_] = 0;
+
+    roots_.clear();
+    uint32_t child = child_[root_];
+    while (child != kNoHeapNode) {
+      uint32_t next = next_[child];
+      next_[child] = kNoHeapNode;
+      prev_[child] = kNoHeapNode;
+      roots_.push_back(child);
+      child = next;
+    }
+
+    if (roots_.empty()) {
+      root_ = kNoHeapNode;
+    } else {
+      // first pass: link pairs from left to right
+      size_t num_linked = 0;
+      for (size_t ii = 0; ii + 1 < roots_.size(); ii += 2) {
+        roots_[num_linked++] = link(roots_[ii], roots_[ii + 1]);
+      }
+      if (roots_.size() % 2 == 1) {
+        roots_[num_linked++] = roots_.back();
+      }
+      // second pass: link from right to left
+      uint32_t cur = roots_[num_linked - 1];
+      for (size_t ii = num_linked - 1; ii > 0; --ii) {
+        cur = link(roots_[ii - 1], cur);
+      }
+      root_ = cur;
+    }
+    --size_;
+    if (EMD_FLOW_STATS) {
+      ++num_pops;
+    }
+  }
+
+  long long num_pushes;
+  long long num_pops;
+  long long num_decrease_keys;
+  long long max_size;
+
+ private:
+  std::vector<Key> key_;
+  // first child, next sibling and previous sibling (the parent for a first
+  // child) of every node in the heap
+  std::vector<uint32_t> child_;
+  std::vector<uint32_t> next_;
+  std::vector<uint32_t> prev_;
+  std::vector<char> in_heap_;
+  uint32_t root_;
+  size_t size_;
+  // temporary list of subtree roots in pop()
+  std::vector<uint32_t> roots_;
+
+  // links two trees and returns the new root
+  uint32_t link(uint32_t a, uint32_t b) {
+    if (key_[b] < key_[a]) {
+      std::swap(a, b);
+    }
+    next_[b] = child_[a];
+    if (child_[a] != kNoHeapNode) {
+      prev_[child_[a]] = b;
+    }
+    prev_[b] = a;
+    child_[a] = b;
+    return a;
+  }
+};
+
+
+// Radix heap for non-negative integer keys. It is monotone: all keys pushed
+// must be at least as large as the last key popped, which holds in Dijkstra's
+// algorithm with non-negative (reduced) edge costs. Entries are stored in
+// buckets according to the highest bit in which the key differs from the
+// last popped key, so every entry is moved at most 64 times. Like
+// LazyBinaryHeap, a push of a queued node inserts a second entry.
+class RadixHeap {
+ public:
+  typedef long long Key;
+
+  RadixHeap() : num_pushes(0), num_pops(0), num_decrease_keys(0),
+      max_size(0), size_(0), last_(0), buckets_(kNumBuckets) { }
+
+  void resize(size_t /*num_nodes*/) {
+    clear();
+  }
+
+  void clear() {
+    for (int ii = 0; ii < kNumBuckets; ++ii) {
+      buckets_[ii].clear();
+    }
+    size_ = 0;
+    last_ = 0;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  void push(uint32_t node, Key key) {
+    uint64_t ukey = static_cast<uint64_t>(key);
+    buckets_[bucket_index(ukey)].push_back(Entry(ukey, node));
+    ++size_;
+    if (EMD_FLOW_STATS) {
+      ++num_pushes;
+      max_size = std::max(max_size, static_cast<long long>(size_));
+    }
+  }
+
+  void pop(uint32_t* node, Key* key) {
+    if (buckets_[0].empty()) {
+      // find the smallest key in the first non-empty bucket and redistribute
+      // the bucket w.r.t. this key
+      int bucket = 1;
+      while (buckets_[bucket].empty()) {
+        ++bucket;
+      }
+      std::vector<Entry>& entries = buckets_[bucket];
+      uint64_t min_key = entries[0].first;
+      for (size_t ii = 1; ii < entries.size(); ++ii) {
+        min_key = std::min(min_key, entries[ii].first);
+      }
+      last_ = min_key;
+      for (size_t ii = 0; ii < entries.size(); ++ii) {
+        buckets_[bucket_index(entries[ii].first)].push_back(entries[ii]);
+      }
+      entries.clear();
+    }
+
+    *key = static_cast<Key>(buckets_[0].back().first);
+    *node = buckets_[0].back().second;
+    buckets_[0].pop_back();
+    --size_;
+    if (EMD_FLOW_STATS) {
+      ++num_pops;
+    }
+  }
+
+  long long num_pushes;
+  long long num_pops;
+  long long num_decrease_keys;
+  long long max_size;
+
+ private:
+  typedef std::pair<uint64_t, uint32_t> Entry;
+  static const int kNumBuckets = 65;
+
+  size_t size_;
+  uint64_t last_;
+  std::vector<std::vector<Entry> > buckets_;
+
+  // 0 if key == last_, otherwise 1 + the index of the highest differing bit
+  int bucket_index(uint64_t key) {
+    uint64_t diff = key ^ last_;
+    return (diff == 0) ? 0 : 64 - __builtin_clzll(diff);
+  }
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef __WORK_STEALING_POOL_H__
+#define __WORK_STEALING_POOL_H__
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <cstddef>
+
+// Per-worker task queues for a fixed set of tasks. The tasks are dealt
+// round-robin to the workers in the given order. A worker takes tasks from
+// the front of its own queue and, once it is empty, steals from the back of
+// the queues of the other workers. So if the tasks are given in order of
+// decreasing cost, every worker starts with the largest tasks and the small
+// tasks at the end balance the load.
+class WorkStealingQueues {
+ public:
+  WorkStealingQueues(int num_workers, const std::vector<size_t>& tasks)
+      : num_steals(0), queues_(num_workers), locks_(num_workers) {
+    for (size_t ii = 0; ii < tasks.size(); ++ii) {
+      queues_[ii % num_workers].push_back(tasks[ii]);
+    }
+  }
+
+  // Returns false if all queues are empty. No tasks are added after the
+  // constructor, so the worker can stop then.
+  bool next_task(int worker, size_t* task) {
+    {
+      std::lock_guard<std::mutex> lock(locks_[worker]);
+      if (!queues_[worker].empty()) {
+        *task = queues_[worker].front();
+        queues_[worker].pop_front();
+        return true;
+      }
+    }
+
+    int num_workers = queues_.size();
+    for (int ii = 1; ii < num_workers; ++ii) {
+      int victim = (worker + ii) % num_workers;
+      std::lock_guard<std::mutex> lock(locks_[victim]);
+      if (!queues_[victim].empty()) {
+        *task = queues_[victim].back();
+        queues_[victim].pop_back();
+        std::lock_guard<std::mutex> steal_lock(steal_lock_);
+        ++num_steals;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  long long num_steals;
+
+ private:
+  std::vector<std::deque<size_t> > queues_;
+  std::vector<std::mutex> locks_;
+  std::mutex steal_lock_;
+};
+
+template <typename Task>
+void run_work_stealing_worker(WorkStealingQueues* queues, int worker,
+    Task* task) {
+  size_t index;
+  while (queues->next_task(worker, &index)) {
+    (*task)(worker, index);
+  }
+}
+
+// Calls (*task)(worker, index) for every index in tasks, using num_workers
+// threads (the calling thread is worker 0). Calls with different workers can
+// run concurrently. Returns the number of stolen tasks.
+template <typename Task>
+long long run_work_stealing(int num_workers, const std::vector<size_t>& tasks,
+    Task* task) {
+  WorkStealingQueues queues(num_workers, tasks);
+  std::vector<std::thread> threads;
+  for (int ii = 1; ii < num_workers; ++ii) {
+    threads.push_back(std::thread(run_work_stealing_worker<Task>, &queues, ii,
+        task));
+  }
+  run_work_stealing_worker(&queues, 0, task);
+  for (size_t ii = 0; ii < threads.size(); ++ii) {
+    threads[ii].join();
+  }
+  return queues.num_steals;
+}
+
+#endif